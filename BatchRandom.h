@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+/// Many independent xorshift32 generators, stepped together.
+/// Each step is a plain loop over the lanes, so the compiler
+/// turns it into vector instructions
+class BatchRandom
+{
+  public:
+    BatchRandom(std::size_t lanes, std::uint64_t seed);
+
+    /// Step every lane once, writing one random word per lane to `out`
+    void next(std::uint32_t* out);
+    std::size_t size() const { return _state.size(); }
+
+  private:
+    std::vector<std::uint32_t> _state;
+};
+
+BatchRandom::BatchRandom(std::size_t lanes, std::uint64_t seed)
+  : _state(lanes)
+{
+    // Spread the seed over the lanes with splitmix64
+    for (auto& state : _state) {
+        seed += 0x9e3779b97f4a7c15ull;
+        std::uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        z ^= z >> 31;
+        // xorshift gets stuck at zero
+        state = static_cast<std::uint32_t>(z) | 1;
+    }
+}
+
+void BatchRandom::next(std::uint32_t* out)
+{
+    std::uint32_t* state = _state.data();
+    const std::size_t lanes = _state.size();
+    for (std::size_t i = 0; i < lanes; ++i) {
+        std::uint32_t x = state[i];
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        state[i] = x;
+        out[i] = x;
+    }
+}
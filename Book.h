@@ -1,7 +1,9 @@
 #pragma once
 
 #include <map>
+#include <list>
 #include <vector>
+#include <unordered_map>
 #include <assert.h>
 #include <algorithm>
 #include <iostream>
@@ -14,13 +16,60 @@
 class Book
 {
   public:
-    /// Add an order to the book
-    /// @return a list of executions that the order generated
-    std::vector<Execution> addOrder(Order order);
+    /// How orders are matched
+    enum class Matching
+    {
+        /// Each order is matched against the book as it arrives
+        Continuous,
+        /// Orders only rest on the book, which may cross, until
+        /// `uncross` clears them all at a single price
+        Auction
+    };
+    /// How an auction shares out the quantity at the marginal
+    /// price level, where not every order can be filled
+    enum class Allocation {TimePriority, ProRata};
+    /// Quantity shown at one price
+    struct DepthLevel
+    {
+        price_t price;
+        quantity_t quantity;
+    };
+
+    /// Add an order to the book. Stop orders wait off the book until
+    /// a trade triggers them, unless the last trade already has
+    /// @param owner the trader the order belongs to, if any. Resting
+    ///              orders are tracked per owner for `cancelAllOrders`
+    /// @return a list of executions that the order generated, including
+    ///         those of any stop orders its trades triggered
+    std::vector<Execution> addOrder(Order order, trader_id_t owner = NO_TRADER);
 
-    /// Cancel a submitted order
+    /// Switch how incoming orders are matched. When going from
+    /// auctions back to continuous matching, switch first and then
+    /// uncross, so stop orders the uncross triggers match as they are
+    /// placed instead of resting on a crossed book
+    void setMatching(Matching matching) { _matching = matching; }
+    Matching getMatching() const { return _matching; }
+    /// Clear all crossing orders at the single price that trades the
+    /// most quantity. Every execution is at that price. Hidden iceberg
+    /// quantity takes part, and triggered stop orders join the book
+    /// @return the executions, with the later order of each pair
+    ///         treated as the aggressor
+    std::vector<Execution> uncross(Allocation allocation = Allocation::TimePriority);
+
+    /// Cancel a submitted order, resting or waiting to trigger
     /// @return if the order was succesfully cancelled
     bool cancelOrder(order_id_t orderid);
+    /// Cancel every order resting on the book for an owner. This only
+    /// touches the owner's own orders, not the rest of the book
+    /// @return the cancelled orders, with their remaining quantity
+    std::vector<Order> cancelAllOrders(trader_id_t owner);
+
+    /// Get an order currently resting on the book, or a stop order
+    /// waiting to trigger
+    /// @return the order, or nullptr if it is not on the book
+    const Order* getOrder(order_id_t orderid) const;
+    /// Get the price of the last trade, or 0 if there hasn't been one
+    price_t getLastPrice() const { return _lastPrice; }
 
     /// Return if the book has a buy order, at any price
     bool hasBid() const;
@@ -36,104 +85,422 @@ class Book
     /// in the book. Note that for a price between the bid/ask spread,
     /// the result is indeterminate
     Side getSideForLevel(price_t price) const;
-    /// Get the quantity currently on the book for a price level
+    /// Get the quantity currently shown on the book for a price
+    /// level. Hidden iceberg quantity isn't counted
     quantity_t getQuantityForLevel(price_t price) const;
+    /// Get the quantity shown on one side of the book at a price.
+    /// Needed when auctions leave the book crossed, as a price can
+    /// then have both bids and offers
+    quantity_t getQuantityForLevel(Side side, price_t price) const;
+    /// Get the levels on one side of the book, best price first
+    /// @param levels replaced with the levels
+    /// @param maxLevels the most levels to get
+    void getDepth(Side side, std::vector<DepthLevel>& levels,
+                  std::size_t maxLevels = std::numeric_limits<std::size_t>::max()) const;
 
     /// Old print method for viewing a book. This is generally deprecated
     void print(price_t minPrice = 1, price_t maxPrice = 20,
                quantity_t maxQuantity = 50) const;
 
   private:
-    Execution trade(Order& order, Order& against);
-    void addOrderToBook(Order order);
+    /// An order resting on the book, or a stop order waiting to
+    /// trigger. Both are also linked into an intrusive list per owner
+    struct RestingOrder
+    {
+        RestingOrder(Order _order, trader_id_t _owner)
+          : order(_order), owner(_owner),
+            displayed(_order.displayQuantity ? std::min(_order.displayQuantity, _order.quantity)
+                                             : _order.quantity),
+            prevForOwner(nullptr), nextForOwner(nullptr) {}
+        Order order;
+        trader_id_t owner;
+        /// Quantity shown on the book, the rest of the order is hidden
+        quantity_t displayed;
+        RestingOrder* prevForOwner;
+        RestingOrder* nextForOwner;
+    };
 
-    std::map<price_t,std::vector<Order>,std::greater<price_t>> _buyOrders;
-    std::map<price_t,std::vector<Order>> _sellOrders;
+    /// All of the orders at a price, in time priority
+    struct Level
+    {
+        std::list<RestingOrder> orders;
+        /// Total quantity shown by all orders at the level
+        quantity_t quantity = 0;
+        /// Total quantity hidden by icebergs at the level
+        quantity_t hidden = 0;
+    };
+
+    /// Stop orders waiting to trigger at one stop price, in time priority
+    using Stops = std::list<RestingOrder>;
+
+    /// Quantity given to a resting order by an auction
+    struct AuctionFill
+    {
+        RestingOrder* resting;
+        Level* level;
+        quantity_t quantity;
+    };
+
+    /// Match an order against one side of the book
+    template<typename Levels>
+    void match(Order& order, Levels& levels, std::vector<Execution>& executions);
+    /// Match an order, if the book is matching continuously, and
+    /// rest what's left of it
+    void placeOrder(Order order, trader_id_t owner, std::vector<Execution>& executions);
+    /// Place stop orders triggered by the executions from `first` on,
+    /// and by the trades those go on to make
+    void triggerStops(std::vector<Execution>& executions, std::size_t first);
+    /// Take the next stop order triggered by the trade at `_lastPrice`
+    /// off its list and place it
+    /// @return if there was one
+    bool placeTriggeredStop(std::vector<Execution>& executions);
+    void removeStop(order_id_t orderid);
+    Execution trade(Order& order, RestingOrder& against);
+    /// Take quantity off a resting order, shown quantity first
+    void takeFromResting(Level& level, RestingOrder& resting, quantity_t quantity);
+    /// Show more of an iceberg whose shown quantity has all traded.
+    /// It goes to the back of its level
+    void replenish(Level& level, std::list<RestingOrder>::iterator restingItr);
+    /// Share `total` out between the orders on one side of the book
+    /// that cross `price`, in price priority
+    template<typename Levels>
+    void allocateAuction(Levels& levels, price_t price, quantity_t total,
+                         Allocation allocation, std::vector<AuctionFill>& fills);
+    void addOrderToBook(Order order, trader_id_t owner);
+    void linkToOwner(RestingOrder& resting);
+    /// Remove a resting order from its owner's list
+    void unlinkFromOwner(RestingOrder& resting);
+    /// Remove a resting order from its level, dropping the level if
+    /// it is now empty. Does not touch the owner's list
+    void removeFromLevel(order_id_t orderid);
+
+    Matching _matching = Matching::Continuous;
+    std::map<price_t,Level,std::greater<price_t>> _buyOrders;
+    std::map<price_t,Level> _sellOrders;
+    std::unordered_map<order_id_t,std::list<RestingOrder>::iterator> _restingOrders;
+    /// Only the front of each of these is ever checked against the
+    /// last trade, so a trade only touches the stops it triggers
+    std::map<price_t,Stops> _buyStops;
+    std::map<price_t,Stops,std::greater<price_t>> _sellStops;
+    std::unordered_map<order_id_t,Stops::iterator> _stopOrders;
+    price_t _lastPrice = 0;
+    /// The most recently added resting order for each owner
+    std::unordered_map<trader_id_t,RestingOrder*> _ownerOrders;
 };
 
-std::vector<Execution> Book::addOrder(Order order)
+std::vector<Execution> Book::addOrder(Order order, trader_id_t owner)
 {
     assert(order.price != 0);
     assert(order.quantity != 0);
     std::vector<Execution> executions;
-    if (order.side == Side::Buy) {
-        auto sellItr = _sellOrders.begin();
-        while (sellItr != _sellOrders.end()) {
-            auto& topOrder = sellItr->second.front();
-            if (topOrder.price > order.price) {
-                break;
-            }
-            executions.emplace_back(trade(order, topOrder));
-            if (topOrder.quantity == 0) {
-                sellItr->second.erase(sellItr->second.begin());
-                if (sellItr->second.size() == 0) {
-                    sellItr = _sellOrders.erase(sellItr);
-                }
-            }
-            if (order.quantity == 0) {
-                break;
-            }
+    bool triggered = _lastPrice != 0 &&
+        (order.side == Side::Buy ? _lastPrice >= order.stopPrice
+                                 : _lastPrice <= order.stopPrice);
+    if (order.stopPrice != 0 && !triggered) {
+        Stops& stops = order.side == Side::Buy ? _buyStops[order.stopPrice]
+                                               : _sellStops[order.stopPrice];
+        stops.emplace_back(order, owner);
+        _stopOrders.emplace(order.id, std::prev(stops.end()));
+        linkToOwner(stops.back());
+        return executions;
+    }
+    placeOrder(order, owner, executions);
+    triggerStops(executions, 0);
+    return executions;
+}
+
+void Book::placeOrder(Order order, trader_id_t owner, std::vector<Execution>& executions)
+{
+    if (_matching == Matching::Continuous) {
+        if (order.side == Side::Buy) {
+            match(order, _sellOrders, executions);
+        } else {
+            match(order, _buyOrders, executions);
         }
-    } else {
-        auto buyItr = _buyOrders.begin();
-        while (buyItr != _buyOrders.end()) {
-            auto& topOrder = buyItr->second.front();
-            if (topOrder.price < order.price) {
-                break;
-            }
-            executions.emplace_back(trade(order, topOrder));
-            if (topOrder.quantity == 0) {
-                buyItr->second.erase(buyItr->second.begin());
-                if (buyItr->second.size() == 0) {
-                    buyItr = _buyOrders.erase(buyItr);
-                }
-            }
-            if (order.quantity == 0) {
-                break;
+    }
+    if (order.quantity != 0) {
+        addOrderToBook(order, owner);
+    }
+}
+
+template<typename Levels>
+void Book::match(Order& order, Levels& levels, std::vector<Execution>& executions)
+{
+    auto levelItr = levels.begin();
+    while (levelItr != levels.end() && order.quantity != 0) {
+        // Levels come in price priority, so the first one that
+        // doesn't cross ends the matching
+        bool crosses = order.side == Side::Buy ? levelItr->first <= order.price
+                                               : levelItr->first >= order.price;
+        if (!crosses) {
+            break;
+        }
+        Level& level = levelItr->second;
+        RestingOrder& top = level.orders.front();
+        executions.emplace_back(trade(order, top));
+        level.quantity -= executions.back().quantity;
+        if (top.order.quantity == 0) {
+            unlinkFromOwner(top);
+            _restingOrders.erase(top.order.id);
+            level.orders.pop_front();
+            if (level.orders.size() == 0) {
+                levelItr = levels.erase(levelItr);
             }
+        } else if (top.displayed == 0) {
+            replenish(level, level.orders.begin());
         }
     }
-    if (order.quantity != 0) {
-        addOrderToBook(order);
+}
+
+void Book::triggerStops(std::vector<Execution>& executions, std::size_t first)
+{
+    // Every trade is checked in turn, as a sweep can pass through a
+    // stop's price and end beyond it. Trades of triggered stops go
+    // on the end, and so are checked in their turn too
+    for (std::size_t i = first; i < executions.size(); ++i) {
+        _lastPrice = executions[i].price;
+        while (placeTriggeredStop(executions)) {}
+    }
+}
+
+bool Book::placeTriggeredStop(std::vector<Execution>& executions)
+{
+    Stops* stops = nullptr;
+    if (_buyStops.size() && _buyStops.begin()->first <= _lastPrice) {
+        stops = &_buyStops.begin()->second;
+    } else if (_sellStops.size() && _sellStops.begin()->first >= _lastPrice) {
+        stops = &_sellStops.begin()->second;
+    } else {
+        return false;
+    }
+    Order order = stops->front().order;
+    trader_id_t owner = stops->front().owner;
+    unlinkFromOwner(stops->front());
+    removeStop(order.id);
+    placeOrder(order, owner, executions);
+    return true;
+}
+
+void Book::removeStop(order_id_t orderid)
+{
+    auto stopItr = _stopOrders.find(orderid);
+    assert(stopItr != _stopOrders.end());
+    auto orderItr = stopItr->second;
+    _stopOrders.erase(stopItr);
+    price_t stopPrice = orderItr->order.stopPrice;
+    if (orderItr->order.side == Side::Buy) {
+        auto levelItr = _buyStops.find(stopPrice);
+        levelItr->second.erase(orderItr);
+        if (levelItr->second.size() == 0) {
+            _buyStops.erase(levelItr);
+        }
+    } else {
+        auto levelItr = _sellStops.find(stopPrice);
+        levelItr->second.erase(orderItr);
+        if (levelItr->second.size() == 0) {
+            _sellStops.erase(levelItr);
+        }
     }
-    return executions;
 }
 
 bool Book::cancelOrder(order_id_t orderid)
 {
-    {
-        auto mapItr = _buyOrders.begin();
-        while (mapItr != _buyOrders.end()) {
-            auto orderItr = mapItr->second.begin();
-            while (orderItr != mapItr->second.end()) {
-                if (orderItr->id == orderid) {
-                    mapItr->second.erase(orderItr);
-                    return true;
-                }
-                ++orderItr;
+    auto itr = _restingOrders.find(orderid);
+    if (itr != _restingOrders.end()) {
+        unlinkFromOwner(*itr->second);
+        removeFromLevel(orderid);
+        return true;
+    }
+    auto stopItr = _stopOrders.find(orderid);
+    if (stopItr != _stopOrders.end()) {
+        unlinkFromOwner(*stopItr->second);
+        removeStop(orderid);
+        return true;
+    }
+    return false;
+}
+
+std::vector<Order> Book::cancelAllOrders(trader_id_t owner)
+{
+    std::vector<Order> cancelled;
+    if (owner == NO_TRADER) {
+        return cancelled;
+    }
+    auto ownerItr = _ownerOrders.find(owner);
+    if (ownerItr == _ownerOrders.end()) {
+        return cancelled;
+    }
+    // The whole list is going away, so there is no need to
+    // unlink the orders one at a time
+    RestingOrder* resting = ownerItr->second;
+    _ownerOrders.erase(ownerItr);
+    while (resting) {
+        RestingOrder* next = resting->nextForOwner;
+        cancelled.push_back(resting->order);
+        if (_restingOrders.count(resting->order.id)) {
+            removeFromLevel(resting->order.id);
+        } else {
+            removeStop(resting->order.id);
+        }
+        resting = next;
+    }
+    return cancelled;
+}
+
+const Order* Book::getOrder(order_id_t orderid) const
+{
+    auto itr = _restingOrders.find(orderid);
+    if (itr != _restingOrders.end()) {
+        return &itr->second->order;
+    }
+    auto stopItr = _stopOrders.find(orderid);
+    if (stopItr != _stopOrders.end()) {
+        return &stopItr->second->order;
+    }
+    return nullptr;
+}
+
+std::vector<Execution> Book::uncross(Allocation allocation)
+{
+    std::vector<Execution> executions;
+    if (!hasBid() || !hasOffer() || getBestBid() < getBestOffer()) {
+        return executions;
+    }
+    // Only prices between the best offer and the best bid can clear.
+    // Lay the depth out over that ladder, as the total buy quantity
+    // at or above each price and sell quantity at or below it
+    const price_t low = getBestOffer();
+    const price_t high = getBestBid();
+    const std::size_t ladder = high - low + 1;
+    std::vector<quantity_t> demand(ladder), supply(ladder);
+    for (auto itr = _buyOrders.begin();
+         itr != _buyOrders.end() && itr->first >= low; ++itr) {
+        demand[itr->first - low] = itr->second.quantity + itr->second.hidden;
+    }
+    for (auto itr = _sellOrders.begin();
+         itr != _sellOrders.end() && itr->first <= high; ++itr) {
+        supply[itr->first - low] = itr->second.quantity + itr->second.hidden;
+    }
+    for (std::size_t i = ladder - 1; i > 0; --i) {
+        demand[i - 1] += demand[i];
+    }
+    for (std::size_t i = 1; i < ladder; ++i) {
+        supply[i] += supply[i - 1];
+    }
+    std::vector<quantity_t> volume(ladder), imbalance(ladder);
+    for (std::size_t i = 0; i < ladder; ++i) {
+        volume[i] = std::min(demand[i], supply[i]);
+        imbalance[i] = std::max(demand[i], supply[i]) - volume[i];
+    }
+    // Most volume wins, then least left over, then the lowest price
+    std::size_t best = 0;
+    for (std::size_t i = 1; i < ladder; ++i) {
+        if (volume[i] > volume[best] ||
+            (volume[i] == volume[best] && imbalance[i] < imbalance[best])) {
+            best = i;
+        }
+    }
+    const price_t price = low + best;
+    const quantity_t total = volume[best];
+
+    std::vector<AuctionFill> buys, sells;
+    allocateAuction(_buyOrders, price, total, allocation, buys);
+    allocateAuction(_sellOrders, price, total, allocation, sells);
+
+    // Pair the two sides off in priority order
+    auto buyItr = buys.begin();
+    auto sellItr = sells.begin();
+    while (buyItr != buys.end() && sellItr != sells.end()) {
+        Order& buyOrder = buyItr->resting->order;
+        Order& sellOrder = sellItr->resting->order;
+        quantity_t quantity = std::min(buyItr->quantity, sellItr->quantity);
+        Side side = buyOrder.id > sellOrder.id ? Side::Buy : Side::Sell;
+        executions.emplace_back(side, quantity, price, buyOrder, sellOrder);
+        for (AuctionFill* fill : {&*buyItr, &*sellItr}) {
+            takeFromResting(*fill->level, *fill->resting, quantity);
+            fill->quantity -= quantity;
+        }
+        if (buyItr->quantity == 0) {
+            ++buyItr;
+        }
+        if (sellItr->quantity == 0) {
+            ++sellItr;
+        }
+    }
+    for (const auto* fills : {&buys, &sells}) {
+        for (const auto& fill : *fills) {
+            if (fill.resting->order.quantity == 0) {
+                unlinkFromOwner(*fill.resting);
+                removeFromLevel(fill.resting->order.id);
+            } else if (fill.resting->displayed == 0) {
+                replenish(*fill.level, _restingOrders[fill.resting->order.id]);
             }
-            ++mapItr;
         }
     }
-    {
-        auto mapItr = _sellOrders.begin();
-        while (mapItr != _sellOrders.end()) {
-            auto orderItr = mapItr->second.begin();
-            while (orderItr != mapItr->second.end()) {
-                if (orderItr->id == orderid) {
-                    mapItr->second.erase(orderItr);
-                    return true;
-                }
-                ++orderItr;
+    triggerStops(executions, 0);
+    return executions;
+}
+
+template<typename Levels>
+void Book::allocateAuction(Levels& levels, price_t price, quantity_t total,
+                           Allocation allocation, std::vector<AuctionFill>& fills)
+{
+    quantity_t remaining = total;
+    for (auto& entry : levels) {
+        if (remaining == 0) {
+            break;
+        }
+        Level& level = entry.second;
+        // Levels come in price priority, so the first one that
+        // doesn't cross ends the allocation
+        bool crosses = level.orders.front().order.side == Side::Buy
+            ? entry.first >= price : entry.first <= price;
+        if (!crosses) {
+            break;
+        }
+        const quantity_t levelQuantity = level.quantity + level.hidden;
+        if (remaining >= levelQuantity) {
+            for (auto& resting : level.orders) {
+                fills.push_back({&resting, &level, resting.order.quantity});
             }
-            ++mapItr;
+            remaining -= levelQuantity;
+            continue;
         }
+        // This is the marginal level: only part of it fills
+        std::size_t first = fills.size();
+        quantity_t allocated = 0;
+        for (auto& resting : level.orders) {
+            quantity_t quantity = 0;
+            if (allocation == Allocation::ProRata) {
+                quantity = static_cast<unsigned long long>(resting.order.quantity)
+                           * remaining / levelQuantity;
+            } else {
+                quantity = std::min(resting.order.quantity, remaining - allocated);
+            }
+            fills.push_back({&resting, &level, quantity});
+            allocated += quantity;
+        }
+        // Rounding down pro-rata shares leaves a little over, which
+        // goes out in time priority
+        for (std::size_t i = first; i < fills.size() && allocated < remaining; ++i) {
+            quantity_t extra = std::min(
+                fills[i].resting->order.quantity - fills[i].quantity,
+                remaining - allocated);
+            fills[i].quantity += extra;
+            allocated += extra;
+        }
+        fills.erase(std::remove_if(fills.begin() + first, fills.end(),
+                                   [](const AuctionFill& fill) {
+                                       return fill.quantity == 0;
+                                   }),
+                    fills.end());
+        break;
     }
-    return false;
 }
 
-Execution Book::trade(Order& order, Order& against)
+Execution Book::trade(Order& order, RestingOrder& resting)
 {
+    Order& against = resting.order;
     // Default with garbage, will set later
     Order buyOrder(order);
     Order sellOrder(order);
@@ -149,19 +516,104 @@ Execution Book::trade(Order& order, Order& against)
     }
     Side executionSide = order.side;
     price_t executionPrice = (order.price + against.price) / 2;
-    quantity_t executionQuantity = std::min(order.quantity, against.quantity);
+    quantity_t executionQuantity = std::min(order.quantity, resting.displayed);
     order.quantity -= executionQuantity;
     against.quantity -= executionQuantity;
+    resting.displayed -= executionQuantity;
     return Execution(executionSide, executionQuantity, executionPrice,
                      buyOrder, sellOrder);
 }
 
-void Book::addOrderToBook(Order order)
+void Book::takeFromResting(Level& level, RestingOrder& resting, quantity_t quantity)
+{
+    quantity_t shown = std::min(resting.displayed, quantity);
+    resting.order.quantity -= quantity;
+    resting.displayed -= shown;
+    level.quantity -= shown;
+    level.hidden -= quantity - shown;
+}
+
+void Book::replenish(Level& level, std::list<RestingOrder>::iterator restingItr)
+{
+    RestingOrder& resting = *restingItr;
+    assert(resting.displayed == 0 && resting.order.quantity != 0);
+    resting.displayed = std::min(resting.order.displayQuantity, resting.order.quantity);
+    level.quantity += resting.displayed;
+    level.hidden -= resting.displayed;
+    // Moving the node keeps every pointer and iterator to it valid
+    level.orders.splice(level.orders.end(), level.orders, restingItr);
+}
+
+void Book::addOrderToBook(Order order, trader_id_t owner)
+{
+    Level& level = order.side == Side::Buy ? _buyOrders[order.price]
+                                           : _sellOrders[order.price];
+    level.orders.emplace_back(order, owner);
+    auto restingItr = std::prev(level.orders.end());
+    level.quantity += restingItr->displayed;
+    level.hidden += order.quantity - restingItr->displayed;
+    _restingOrders.emplace(order.id, restingItr);
+    linkToOwner(*restingItr);
+}
+
+void Book::linkToOwner(RestingOrder& resting)
+{
+    if (resting.owner == NO_TRADER) {
+        return;
+    }
+    RestingOrder*& head = _ownerOrders[resting.owner];
+    resting.nextForOwner = head;
+    if (head) {
+        head->prevForOwner = &resting;
+    }
+    head = &resting;
+}
+
+void Book::unlinkFromOwner(RestingOrder& resting)
+{
+    if (resting.owner == NO_TRADER) {
+        return;
+    }
+    if (resting.nextForOwner) {
+        resting.nextForOwner->prevForOwner = resting.prevForOwner;
+    }
+    if (resting.prevForOwner) {
+        resting.prevForOwner->nextForOwner = resting.nextForOwner;
+    } else if (resting.nextForOwner) {
+        _ownerOrders[resting.owner] = resting.nextForOwner;
+    } else {
+        _ownerOrders.erase(resting.owner);
+    }
+    resting.prevForOwner = nullptr;
+    resting.nextForOwner = nullptr;
+}
+
+void Book::removeFromLevel(order_id_t orderid)
 {
+    auto restingItr = _restingOrders.find(orderid);
+    assert(restingItr != _restingOrders.end());
+    auto orderItr = restingItr->second;
+    _restingOrders.erase(restingItr);
+    const Order& order = orderItr->order;
+    const quantity_t hidden = order.quantity - orderItr->displayed;
     if (order.side == Side::Buy) {
-        _buyOrders[order.price].push_back(order);
+        auto levelItr = _buyOrders.find(order.price);
+        assert(levelItr != _buyOrders.end());
+        levelItr->second.quantity -= orderItr->displayed;
+        levelItr->second.hidden -= hidden;
+        levelItr->second.orders.erase(orderItr);
+        if (levelItr->second.orders.size() == 0) {
+            _buyOrders.erase(levelItr);
+        }
     } else {
-        _sellOrders[order.price].push_back(order);
+        auto levelItr = _sellOrders.find(order.price);
+        assert(levelItr != _sellOrders.end());
+        levelItr->second.quantity -= orderItr->displayed;
+        levelItr->second.hidden -= hidden;
+        levelItr->second.orders.erase(orderItr);
+        if (levelItr->second.orders.size() == 0) {
+            _sellOrders.erase(levelItr);
+        }
     }
 }
 
@@ -201,29 +653,42 @@ Side Book::getSideForLevel(price_t price) const
 
 quantity_t Book::getQuantityForLevel(price_t price) const
 {
-    Side side = getSideForLevel(price);
+    return getQuantityForLevel(getSideForLevel(price), price);
+}
+
+quantity_t Book::getQuantityForLevel(Side side, price_t price) const
+{
     if (side == Side::Buy) {
         auto itr = _buyOrders.find(price);
         if (itr != _buyOrders.end()) {
-            quantity_t quantity = 0;
-            for (const auto& order : itr->second) {
-                quantity += order.quantity;
-            }
-            return quantity;
+            return itr->second.quantity;
         }
     } else {
         auto itr = _sellOrders.find(price);
         if (itr != _sellOrders.end()) {
-            quantity_t quantity = 0;
-            for (const auto& order : itr->second) {
-                quantity += order.quantity;
-            }
-            return quantity;
+            return itr->second.quantity;
         }
     }
     return 0;
 }
 
+void Book::getDepth(Side side, std::vector<DepthLevel>& levels,
+                    std::size_t maxLevels) const
+{
+    levels.clear();
+    auto copy = [&](const auto& book) {
+        for (auto itr = book.begin();
+             itr != book.end() && levels.size() < maxLevels; ++itr) {
+            levels.push_back({itr->first, itr->second.quantity});
+        }
+    };
+    if (side == Side::Buy) {
+        copy(_buyOrders);
+    } else {
+        copy(_sellOrders);
+    }
+}
+
 void Book::print(price_t minPrice, price_t maxPrice,
                  quantity_t maxQuantity) const
 {
@@ -0,0 +1,138 @@
+/**
+ * Columnar files. A column is a file holding nothing but an array of
+ * one plain type, in the machine's own layout, so it can be appended
+ * to cheaply and memory mapped straight back into an array
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// Appends values to a column file
+template <typename T>
+class ColumnWriter
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+  public:
+    ColumnWriter() = default;
+    ~ColumnWriter() { close(); }
+    ColumnWriter(const ColumnWriter&) = delete;
+    ColumnWriter& operator=(const ColumnWriter&) = delete;
+
+    /// Open a column, keeping anything already in it
+    /// @return if the file could be opened
+    bool open(const std::string& path);
+    /// @return if everything appended since opening was written
+    bool close();
+
+    void append(const T* values, std::size_t count);
+    void append(const std::vector<T>& values) { append(values.data(), values.size()); }
+
+  private:
+    std::FILE* _file = nullptr;
+    bool _failed = false;
+};
+
+/// A column file mapped into memory, read only
+template <typename T>
+class Column
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+  public:
+    Column() = default;
+    ~Column() { close(); }
+    Column(const Column&) = delete;
+    Column& operator=(const Column&) = delete;
+
+    /// @return if the file exists and holds whole values
+    bool open(const std::string& path);
+    void close();
+
+    const T* data() const { return _data; }
+    std::size_t size() const { return _size; }
+    const T& operator[](std::size_t index) const { return _data[index]; }
+    const T* begin() const { return _data; }
+    const T* end() const { return _data + _size; }
+
+  private:
+    const T* _data = nullptr;
+    std::size_t _size = 0;
+};
+
+template <typename T>
+bool ColumnWriter<T>::open(const std::string& path)
+{
+    close();
+    _file = std::fopen(path.c_str(), "ab");
+    _failed = !_file;
+    return _file;
+}
+
+template <typename T>
+bool ColumnWriter<T>::close()
+{
+    if (_file && std::fclose(_file) != 0) {
+        _failed = true;
+    }
+    _file = nullptr;
+    return !_failed;
+}
+
+template <typename T>
+void ColumnWriter<T>::append(const T* values, std::size_t count)
+{
+    if (!_file || count == 0) {
+        return;
+    }
+    if (std::fwrite(values, sizeof(T), count, _file) != count ||
+        std::fflush(_file) != 0) {
+        _failed = true;
+    }
+}
+
+template <typename T>
+bool Column<T>::open(const std::string& path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size % sizeof(T) != 0) {
+        ::close(fd);
+        return false;
+    }
+    // Empty files can't be mapped, but are still valid empty columns
+    if (info.st_size == 0) {
+        ::close(fd);
+        return true;
+    }
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    _data = static_cast<const T*>(data);
+    _size = info.st_size / sizeof(T);
+    return true;
+}
+
+template <typename T>
+void Column<T>::close()
+{
+    if (_data) {
+        munmap(const_cast<T*>(_data), _size * sizeof(T));
+    }
+    _data = nullptr;
+    _size = 0;
+}
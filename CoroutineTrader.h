@@ -0,0 +1,268 @@
+/**
+ * Traders whose strategy is written as a single coroutine. Instead
+ * of reacting to `tick` and the notifications, the strategy
+ * `co_await`s the next thing it cares about, and is resumed only
+ * when that happens
+ */
+
+#pragma once
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+
+#include "Trader.h"
+
+/// The coroutine a `CoroutineTrader` runs its strategy in
+class Strategy
+{
+  public:
+    struct promise_type
+    {
+        Strategy get_return_object()
+        {
+            return Strategy(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        /// Strategies start on the trader's first tick, not when created
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Strategy() = default;
+    Strategy(Strategy&& other) : _handle(other._handle) { other._handle = nullptr; }
+    Strategy& operator=(Strategy&& other);
+    Strategy(const Strategy&) = delete;
+    Strategy& operator=(const Strategy&) = delete;
+    ~Strategy() { if (_handle) _handle.destroy(); }
+
+    /// Whether there is a strategy that hasn't finished yet
+    bool running() const { return _handle && !_handle.done(); }
+    void resume() { _handle.resume(); }
+
+  private:
+    explicit Strategy(std::coroutine_handle<promise_type> handle)
+      : _handle(handle) {}
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+Strategy& Strategy::operator=(Strategy&& other)
+{
+    if (this != &other) {
+        if (_handle) {
+            _handle.destroy();
+        }
+        _handle = other._handle;
+        other._handle = nullptr;
+    }
+    return *this;
+}
+
+class CoroutineTrader : public Trader
+{
+  public:
+    /// A (perhaps partial) fill of one of the trader's orders
+    struct Fill
+    {
+        /// The order at the time of the fill
+        Order order;
+        quantity_t quantity;
+        price_t price;
+    };
+
+    CoroutineTrader(Exchange& exchange);
+
+    void tick() final;
+    void notifyTraded(const Order& origOrder, quantity_t quantity, price_t price) final;
+    void notifyCancelled(const Order& order) final;
+    void notifySettled() final;
+
+  protected:
+    /// The strategy. Called once, on the trader's first tick
+    virtual Strategy run() = 0;
+
+    struct FillAwaiter;
+    struct BookAwaiter;
+    struct SleepAwaiter;
+    struct CancelAwaiter;
+
+    /// Wait for the next fill of any of the trader's orders. Once a
+    /// strategy has asked for a fill, fills that happen while it is
+    /// waiting on something else are kept until it asks again
+    FillAwaiter nextFill();
+    /// Wait until a condition holds. It is checked whenever the
+    /// best bid or offer changes and whenever the trader's orders
+    /// fill or are cancelled
+    BookAwaiter bookCondition(std::function<bool(const Book&)> condition);
+    /// Wait for a number of rounds
+    SleepAwaiter sleep(round_t rounds);
+    /// Cancel an order, resuming with whether it was cancelled.
+    /// Cancels are acknowledged straight away, so this never suspends
+    CancelAwaiter cancel(order_id_t orderid);
+
+  private:
+    enum class Waiting {Nothing, Fill, Book, Sleep};
+
+    /// Resume the strategy if what it is waiting for has happened
+    void resumeIfReady();
+
+    Strategy _strategy;
+    bool _started = false;
+    /// Set while the strategy is running, so events it causes
+    /// itself don't resume it again
+    bool _resuming = false;
+
+    Waiting _waiting = Waiting::Nothing;
+    /// Strategies that never look at fills don't pay to keep them
+    bool _keepFills = false;
+    std::deque<Fill> _fills;
+    std::function<bool(const Book&)> _condition;
+    round_t _wakeRound = 0;
+};
+
+struct CoroutineTrader::FillAwaiter
+{
+    CoroutineTrader& trader;
+    bool await_ready() const { return trader._fills.size() != 0; }
+    void await_suspend(std::coroutine_handle<>) { trader._waiting = Waiting::Fill; }
+    Fill await_resume()
+    {
+        Fill fill = trader._fills.front();
+        trader._fills.pop_front();
+        return fill;
+    }
+};
+
+struct CoroutineTrader::BookAwaiter
+{
+    CoroutineTrader& trader;
+    std::function<bool(const Book&)> condition;
+    bool await_ready() const { return condition(trader._exchange.getBook()); }
+    void await_suspend(std::coroutine_handle<>)
+    {
+        trader._condition = std::move(condition);
+        trader._waiting = Waiting::Book;
+        trader.wakeOnTopOfBookChange();
+    }
+    void await_resume() {}
+};
+
+struct CoroutineTrader::SleepAwaiter
+{
+    CoroutineTrader& trader;
+    round_t rounds;
+    bool await_ready() const { return rounds == 0; }
+    void await_suspend(std::coroutine_handle<>)
+    {
+        trader._wakeRound = trader._exchange.getRound() + rounds;
+        trader._waiting = Waiting::Sleep;
+        trader.wakeAfter(rounds);
+    }
+    void await_resume() {}
+};
+
+struct CoroutineTrader::CancelAwaiter
+{
+    CoroutineTrader& trader;
+    order_id_t orderid;
+    bool await_ready() const { return true; }
+    void await_suspend(std::coroutine_handle<>) {}
+    bool await_resume() { return trader.cancelOrder(orderid); }
+};
+
+CoroutineTrader::CoroutineTrader(Exchange& exchange)
+  : Trader(exchange)
+{
+    stopPolling();
+    wakeAfter(1);
+}
+
+CoroutineTrader::FillAwaiter CoroutineTrader::nextFill()
+{
+    _keepFills = true;
+    return {*this};
+}
+
+CoroutineTrader::BookAwaiter CoroutineTrader::bookCondition(
+    std::function<bool(const Book&)> condition)
+{
+    return {*this, std::move(condition)};
+}
+
+CoroutineTrader::SleepAwaiter CoroutineTrader::sleep(round_t rounds)
+{
+    return {*this, rounds};
+}
+
+CoroutineTrader::CancelAwaiter CoroutineTrader::cancel(order_id_t orderid)
+{
+    return {*this, orderid};
+}
+
+void CoroutineTrader::tick()
+{
+    if (!_started) {
+        _started = true;
+        _strategy = run();
+        _resuming = true;
+        _strategy.resume();
+        _resuming = false;
+        return;
+    }
+    resumeIfReady();
+    // Top of book subscriptions only fire once
+    if (_waiting == Waiting::Book) {
+        wakeOnTopOfBookChange();
+    }
+}
+
+void CoroutineTrader::notifyTraded(const Order& origOrder, quantity_t quantity, price_t price)
+{
+    if (_keepFills) {
+        _fills.push_back({origOrder, quantity, price});
+    }
+    // The strategy may trade or cancel on the fill, so it is only
+    // resumed once the exchange has finished settling
+    deferUntilSettled();
+}
+
+void CoroutineTrader::notifyCancelled(const Order& order)
+{
+    resumeIfReady();
+}
+
+void CoroutineTrader::notifySettled()
+{
+    resumeIfReady();
+}
+
+void CoroutineTrader::resumeIfReady()
+{
+    if (_resuming || !_strategy.running()) {
+        return;
+    }
+    bool ready = false;
+    switch (_waiting) {
+        case Waiting::Nothing:
+            break;
+        case Waiting::Fill:
+            ready = _fills.size() != 0;
+            break;
+        case Waiting::Book:
+            ready = _condition(_exchange.getBook());
+            break;
+        case Waiting::Sleep:
+            ready = _exchange.getRound() >= _wakeRound;
+            break;
+    }
+    if (!ready) {
+        return;
+    }
+    _waiting = Waiting::Nothing;
+    _resuming = true;
+    _strategy.resume();
+    _resuming = false;
+}
@@ -0,0 +1,221 @@
+/**
+ * What each trader costs the exchange: time spent inside its
+ * callbacks, and how many orders, cancels and fills it causes. The
+ * exchange only keeps these while cost accounting is turned on
+ */
+
+#pragma once
+
+#include <map>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <ostream>
+#include <typeinfo>
+#include <algorithm>
+#include <unordered_map>
+#include <cxxabi.h>
+
+#include "Order.h"
+#include "Scheduler.h"
+
+/// Costs of one trader, or of every trader of one class
+struct TraderCost
+{
+    /// The trader's class
+    std::string type;
+    /// Calls to, and nanoseconds spent in, each callback
+    std::uint64_t tickCalls = 0;
+    std::uint64_t tickNanos = 0;
+    std::uint64_t acceptedCalls = 0;
+    std::uint64_t acceptedNanos = 0;
+    std::uint64_t tradedCalls = 0;
+    std::uint64_t tradedNanos = 0;
+    std::uint64_t settledCalls = 0;
+    std::uint64_t settledNanos = 0;
+    /// Orders and cancels sent, and fills of the trader's orders
+    std::uint64_t orders = 0;
+    std::uint64_t cancels = 0;
+    std::uint64_t fills = 0;
+
+    std::uint64_t totalNanos() const
+    {
+        return tickNanos + acceptedNanos + tradedNanos + settledNanos;
+    }
+    TraderCost& operator+=(const TraderCost& other);
+};
+
+class CostAccounting
+{
+  public:
+    /// The trader callbacks that are timed
+    enum class Callback {Tick, OrderAccepted, Traded, Settled};
+    using clock = std::chrono::steady_clock;
+
+    /// Get the costs of a trader, adding it if this is its first
+    /// @param type the trader's class. The latest one given is kept,
+    ///             as calls made while the trader is being built or
+    ///             torn down only see part of it
+    TraderCost& get(trader_id_t trader, const std::type_info& type);
+    void addCall(trader_id_t trader, const std::type_info& type,
+                 Callback callback, clock::duration time);
+
+    /// Costs of every trader seen, by trader id
+    std::map<trader_id_t,TraderCost> getTraders() const;
+    /// Costs summed over every trader of each class
+    std::map<std::string,TraderCost> getTypes() const;
+
+    /// Write the costs as CSV: a row per trader, most expensive first,
+    /// then a row per class. Rates are per round, over `rounds` rounds
+    void writeCsv(std::ostream& out, round_t rounds) const;
+
+    void clear() { _traders.clear(); }
+
+  private:
+    struct Entry
+    {
+        /// Names are only worked out when the costs are read
+        const std::type_info* type;
+        TraderCost cost;
+    };
+
+    static std::string typeName(const std::type_info& type);
+    /// Quote a CSV field if it needs it. Names of template classes
+    /// have commas in them
+    static std::string csvField(const std::string& text);
+
+    std::unordered_map<trader_id_t,Entry> _traders;
+};
+
+TraderCost& TraderCost::operator+=(const TraderCost& other)
+{
+    tickCalls += other.tickCalls;
+    tickNanos += other.tickNanos;
+    acceptedCalls += other.acceptedCalls;
+    acceptedNanos += other.acceptedNanos;
+    tradedCalls += other.tradedCalls;
+    tradedNanos += other.tradedNanos;
+    settledCalls += other.settledCalls;
+    settledNanos += other.settledNanos;
+    orders += other.orders;
+    cancels += other.cancels;
+    fills += other.fills;
+    return *this;
+}
+
+TraderCost& CostAccounting::get(trader_id_t trader, const std::type_info& type)
+{
+    Entry& entry = _traders[trader];
+    entry.type = &type;
+    return entry.cost;
+}
+
+std::map<trader_id_t,TraderCost> CostAccounting::getTraders() const
+{
+    std::map<trader_id_t,TraderCost> traders;
+    for (const auto& entry : _traders) {
+        TraderCost& cost = traders[entry.first] = entry.second.cost;
+        cost.type = typeName(*entry.second.type);
+    }
+    return traders;
+}
+
+void CostAccounting::addCall(trader_id_t trader, const std::type_info& type,
+                             Callback callback, clock::duration time)
+{
+    TraderCost& cost = get(trader, type);
+    std::uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+    switch (callback) {
+        case Callback::Tick:
+            ++cost.tickCalls;
+            cost.tickNanos += nanos;
+            break;
+        case Callback::OrderAccepted:
+            ++cost.acceptedCalls;
+            cost.acceptedNanos += nanos;
+            break;
+        case Callback::Traded:
+            ++cost.tradedCalls;
+            cost.tradedNanos += nanos;
+            break;
+        case Callback::Settled:
+            ++cost.settledCalls;
+            cost.settledNanos += nanos;
+            break;
+    }
+}
+
+std::map<std::string,TraderCost> CostAccounting::getTypes() const
+{
+    std::map<std::string,TraderCost> types;
+    for (const auto& entry : getTraders()) {
+        TraderCost& total = types[entry.second.type];
+        total.type = entry.second.type;
+        total += entry.second;
+    }
+    return types;
+}
+
+void CostAccounting::writeCsv(std::ostream& out, round_t rounds) const
+{
+    double perRound = rounds ? 1.0 / rounds : 0;
+    auto writeRow = [&](const char* scope, const std::string& id,
+                        const TraderCost& cost) {
+        out << scope << ',' << csvField(cost.type) << ',' << id << ','
+            << cost.tickCalls << ',' << cost.tickNanos << ','
+            << cost.acceptedCalls << ',' << cost.acceptedNanos << ','
+            << cost.tradedCalls << ',' << cost.tradedNanos << ','
+            << cost.settledCalls << ',' << cost.settledNanos << ','
+            << cost.orders << ',' << cost.cancels << ',' << cost.fills << ','
+            << cost.totalNanos() * perRound << ','
+            << cost.orders * perRound << ','
+            << cost.cancels * perRound << ','
+            << cost.fills * perRound << '\n';
+    };
+    out << "scope,type,trader,tick_calls,tick_ns,accepted_calls,accepted_ns,"
+           "traded_calls,traded_ns,settled_calls,settled_ns,orders,cancels,fills,"
+           "ns_per_round,orders_per_round,cancels_per_round,fills_per_round\n";
+
+    auto costs = getTraders();
+    std::vector<std::pair<trader_id_t,const TraderCost*>> traders;
+    for (const auto& entry : costs) {
+        traders.emplace_back(entry.first, &entry.second);
+    }
+    std::sort(traders.begin(), traders.end(), [](const auto& a, const auto& b) {
+        return a.second->totalNanos() != b.second->totalNanos()
+            ? a.second->totalNanos() > b.second->totalNanos()
+            : a.first < b.first;
+    });
+    for (const auto& trader : traders) {
+        writeRow("trader", std::to_string(trader.first), *trader.second);
+    }
+    for (const auto& type : getTypes()) {
+        writeRow("type", "", type.second);
+    }
+}
+
+std::string CostAccounting::typeName(const std::type_info& type)
+{
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : type.name();
+    std::free(demangled);
+    return name;
+}
+
+std::string CostAccounting::csvField(const std::string& text)
+{
+    if (text.find_first_of(",\"\n") == std::string::npos) {
+        return text;
+    }
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"') {
+            quoted += '"';
+        }
+        quoted += c;
+    }
+    return quoted + '"';
+}
@@ -13,7 +13,13 @@ class DealerTrader : public Trader
                  price_t midpoint = (MARKET_MAX_PRICE - MARKET_MIN_PRICE) / 2,
                  price_t spread = 2)
       : Trader(exchange), _midpoint(midpoint),
-        _spread(spread) {}
+        _spread(spread)
+    {
+        // Quotes only depend on free money and shares, which
+        // only change when an order fills or is cancelled
+        stopPolling();
+        wakeAfter(1);
+    }
 
     void tick() final
     {
@@ -27,6 +33,18 @@ class DealerTrader : public Trader
         }
     }
 
+    void notifyTraded(const Order& origOrder, quantity_t quantity, price_t price) final
+    {
+        Trader::notifyTraded(origOrder, quantity, price);
+        wakeAfter(1);
+    }
+
+    void notifyCancelled(const Order& order) final
+    {
+        Trader::notifyCancelled(order);
+        wakeAfter(1);
+    }
+
   private:
     price_t _midpoint;
     price_t _spread;
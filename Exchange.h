@@ -1,60 +1,524 @@
 #pragma once
 
+#include <deque>
 #include <queue>
 #include <vector>
+#include <random>
+#include <functional>
 #include <unordered_map>
 
 #include "Book.h"
+#include "Ledger.h"
+#include "Scheduler.h"
+#include "MarketData.h"
+#include "CostAccounting.h"
 #include "Curses.h"
 
 class Trader;
 
+/// Handle to an execution listener on an exchange
+using listener_id_t = unsigned int;
+
 class Exchange
 {
   public:
+    /// @param seed seeds the random numbers traders on
+    ///             this exchange draw from
+    explicit Exchange(std::uint32_t seed = 1) : _random(seed) {}
+
     void tick();
+    /// Queue an order for one of a trader's accounts, locking the
+    /// money or shares it needs
+    void submitOrder(Trader& trader, Order order, trader_id_t account);
     void submitOrder(Trader& trader, Order order);
-    void submitCancel(Trader& trader, order_id_t orderid);
-    void addTrader(Trader* trader) { _traders.push_back(trader); }
+    /// Cancel one of a trader's resting orders
+    /// @return if the order was succesfully cancelled
+    bool submitCancel(Trader& trader, order_id_t orderid);
+    /// Cancel all resting orders for one of a trader's accounts
+    /// @return the number of orders cancelled
+    std::size_t submitCancelAll(Trader& trader, trader_id_t account);
+    std::size_t submitCancelAll(Trader& trader);
+
+    /// Add a trader to the exchange, with one account
+    /// @param money, shares the account's starting balances
+    /// @return the id of the trader, which is also its first account
+    trader_id_t addTrader(Trader* trader, price_t money, quantity_t shares);
+    /// Open another account for the trader that was added last.
+    /// A trader's accounts always have consecutive ids
+    /// @return the id of the account
+    trader_id_t addAccount(Trader& trader);
+    /// Open another account with the given starting balances
+    trader_id_t addAccount(Trader& trader, price_t money, quantity_t shares);
+    /// Disconnect a trader from the exchange. All of the trader's
+    /// resting and queued orders are dropped: resting ones straight
+    /// away, and queued ones as they come up
+    void removeTrader(Trader& trader);
+
+    /// Set whether a trader is ticked every round. Traders poll by
+    /// default; traders that don't are only ticked when a wakeup
+    /// they asked for comes due
+    void setPolling(Trader& trader, bool polling);
+    /// Tick a trader at a future round
+    void scheduleWakeup(Trader& trader, round_t when);
+    /// Tick a trader once, on the round after the best bid or
+    /// offer next changes
+    void subscribeTopOfBook(Trader& trader);
+    /// Call a trader's `notifySettled` once every execution being
+    /// settled has been settled and its traders notified. Traders
+    /// that act on fills rather than just record them ask for this
+    /// from `notifyTraded`
+    void deferUntilSettled(Trader& trader);
+    /// Get the current round
+    round_t getRound() const { return _round; }
+    /// Number of orders waiting to go through the book. The round
+    /// is over once these are all through
+    std::size_t getQueuedOrders() const { return _orderQueue.size(); }
+
+    /// Run the book as a periodic call auction, uncrossing it at the
+    /// start of every `rounds`th round. 0 goes back to continuous
+    /// matching, after one last auction
+    void setAuctionInterval(round_t rounds,
+                            Book::Allocation allocation = Book::Allocation::TimePriority);
+
+    /// Call `listener` with every execution, after it is settled
+    /// @return a handle to remove the listener with
+    listener_id_t addExecutionListener(std::function<void(const Execution&)> listener);
+    /// Stop calling a listener. Anything the listener refers to
+    /// must outlive it, so must remove it before going away. A
+    /// listener may remove itself, or any other, while it runs
+    void removeExecutionListener(listener_id_t listener);
+
+    /// Random numbers for traders on this exchange. Traders should
+    /// use this rather than `rand()`, so that runs are repeatable
+    /// and separate exchanges don't share state
+    std::mt19937& getRandom() { return _random; }
+
+    /// Publish a snapshot of the book's depth to `getMarketData` at the
+    /// start of every `rounds`th round. 0, the default, stops publishing
+    void setDepthSnapshotInterval(round_t rounds) { _depthSnapshotInterval = rounds; }
+    /// Turn on timing trader callbacks and counting each trader's
+    /// orders, cancels and fills, read from `getCostAccounting`
+    void setCostAccounting(bool enabled) { _costAccounting = enabled; }
+    const CostAccounting& getCostAccounting() const { return _costs; }
 
+    /// Book state that other threads can read while the exchange runs
+    const MarketData& getMarketData() const { return _marketData; }
+
+    /// Get the book. Only safe from the exchange's own thread
     const Book& getBook() const { return _book; }
+    /// Balances of every trader, indexed by trader id
+    Ledger& getLedger() { return _ledger; }
+    const Ledger& getLedger() const { return _ledger; }
     void draw(Curses& curses);
   private:
+    /// Wake up every trader that is due for the next round
+    void tickTraders();
+    /// Settle a batch of executions, then notify both traders of each
+    void settle(const std::vector<Execution>& execs);
+    /// Uncross the book and settle the results
+    void runAuction();
+    /// Drop listeners removed while the listeners were being called
+    void dropRemovedListeners();
+    /// Record if the best bid or offer moved, and publish it
+    void checkTopOfBook();
+    /// Call into a trader, timing the call if cost accounting is on
+    template<typename Call>
+    void callTrader(Trader& trader, CostAccounting::Callback callback, Call call);
+    /// Count an order, cancel or fill against a trader, if cost
+    /// accounting is on
+    void countFor(Trader& trader, std::uint64_t TraderCost::*counter);
+
     Book _book;
+    Ledger _ledger;
+    MarketData _marketData;
+    /// Rounds between depth snapshots, or 0 for none
+    round_t _depthSnapshotInterval = 0;
+    bool _costAccounting = false;
+    CostAccounting _costs;
+    /// Reused between draws to avoid reallocating
+    Ledger::Valuation _valuation;
+    /// Owner of each account. Ids are shared between traders and
+    /// accounts: a trader's id is the id of its first account
     std::vector<Trader*> _traders;
-    std::queue<std::pair<Trader*,Order>> _orderQueue;
-    std::unordered_map<order_id_t,Trader*> _orderToTraderMap;
+    std::queue<std::pair<trader_id_t,Order>> _orderQueue;
+    /// Account of every order that is live on the book
+    std::unordered_map<order_id_t,trader_id_t> _orderToAccountMap;
+
+    round_t _round = 0;
+    Scheduler _scheduler;
+    std::mt19937 _random;
+    struct ExecutionListener
+    {
+        listener_id_t id;
+        /// Cleared when removed while listeners are being called. The
+        /// entry itself goes once they are done, as it may be running
+        bool active;
+        std::function<void(const Execution&)> call;
+    };
+    /// A deque, so adding a listener doesn't move one that is running
+    std::deque<ExecutionListener> _executionListeners;
+    listener_id_t _nextListener = 0;
+    /// How deep calls to the listeners are nested
+    unsigned int _callingListeners = 0;
+
+    /// Rounds between auctions, or 0 for continuous matching
+    round_t _auctionInterval = 0;
+    Book::Allocation _auctionAllocation = Book::Allocation::TimePriority;
+    /// Traders ticked every round, in the order they were added
+    std::vector<trader_id_t> _pollingTraders;
+    /// Whether `_pollingTraders` holds traders that have disconnected
+    bool _pollingDisconnected = false;
+    /// Traders waiting for the best bid or offer to change
+    std::vector<trader_id_t> _topOfBookSubscribers;
+    std::vector<bool> _subscribedTopOfBook;
+    bool _topOfBookChanged = false;
+    /// Traders waiting for the executions being settled to finish
+    std::vector<trader_id_t> _settleWaiters;
+    std::vector<bool> _waitingForSettle;
+    price_t _lastBestBid = std::numeric_limits<price_t>::min();
+    price_t _lastBestOffer = std::numeric_limits<price_t>::max();
+    /// Last round each trader was ticked, so a trader woken
+    /// for several reasons is only ticked once
+    std::vector<round_t> _lastTicked;
+    /// Reused between rounds to avoid reallocating
+    std::vector<trader_id_t> _ticking;
 };
 
 #include "Trader.h"
 
 void Exchange::tick()
 {
+    if (_marketData.hasPendingDepth()) {
+        _marketData.publishPendingDepth();
+    }
+    // Orders of traders that have disconnected are dropped
+    // here, rather than searched for when they leave
+    while (_orderQueue.size() && !_traders[_orderQueue.front().first]) {
+        const auto& dropped = _orderQueue.front();
+        _ledger.releaseForOrder(dropped.first, dropped.second);
+        _orderQueue.pop();
+    }
     // If there are no orders to process,
-    // tick all the traders
+    // start a new round and tick the traders
     if (_orderQueue.size() == 0) {
-        for (Trader *trader : _traders) {
-            trader->tick();
-        }
+        tickTraders();
         return;
     }
     // Otherwise, process the first order
-    std::pair<Trader*,Order> next = _orderQueue.front();
+    std::pair<trader_id_t,Order> next = _orderQueue.front();
     _orderQueue.pop();
-    _orderToTraderMap.emplace(next.second.id, next.first);
-    next.first->notifyOrderAccepted(next.second);
-    std::vector<Execution> execs = _book.addOrder(next.second);
+    const Order& order = next.second;
+    _orderToAccountMap.emplace(order.id, next.first);
+    Trader& trader = *_traders[next.first];
+    callTrader(trader, CostAccounting::Callback::OrderAccepted,
+               [&]() { trader.notifyOrderAccepted(order); });
+    settle(_book.addOrder(order, next.first));
+    checkTopOfBook();
+}
+
+void Exchange::settle(const std::vector<Execution>& execs)
+{
+    // The whole batch is settled before any trader hears of it, so
+    // traders see a settled ledger, and a trader cancelling an order
+    // can't strand fills of it later in the batch
+    std::vector<trader_id_t> accounts;
+    accounts.reserve(execs.size() * 2);
+    for (const auto& exec : execs) {
+        for (const Order* filled : {&exec.buyOrder, &exec.sellOrder}) {
+            auto accountItr = _orderToAccountMap.find(filled->id);
+            assert(accountItr != _orderToAccountMap.end());
+            trader_id_t account = accountItr->second;
+            _ledger.settleTrade(account, *filled, exec.quantity, exec.price);
+            accounts.push_back(account);
+            if (filled->quantity == exec.quantity) {
+                _orderToAccountMap.erase(accountItr);
+            }
+        }
+    }
+    auto account = accounts.begin();
     for (const auto& exec : execs) {
-        _orderToTraderMap[exec.buyOrder.id]->notifyTraded(
-            exec.buyOrder, exec.quantity, exec.price);
-        _orderToTraderMap[exec.sellOrder.id]->notifyTraded(
-            exec.sellOrder, exec.quantity, exec.price);
+        for (const Order* filled : {&exec.buyOrder, &exec.sellOrder}) {
+            // The trader may have disconnected earlier in the batch
+            Trader* trader = _traders[*account++];
+            if (!trader) {
+                continue;
+            }
+            countFor(*trader, &TraderCost::fills);
+            callTrader(*trader, CostAccounting::Callback::Traded,
+                       [&]() { trader->notifyTraded(*filled, exec.quantity, exec.price); });
+        }
+        // By index, as a listener may add more
+        ++_callingListeners;
+        for (std::size_t i = 0; i < _executionListeners.size(); ++i) {
+            if (_executionListeners[i].active) {
+                _executionListeners[i].call(exec);
+            }
+        }
+        if (--_callingListeners == 0) {
+            dropRemovedListeners();
+        }
+    }
+    // Taken out first, as the traders may settle more themselves
+    std::vector<trader_id_t> waiters;
+    waiters.swap(_settleWaiters);
+    for (trader_id_t id : waiters) {
+        _waitingForSettle[id] = false;
+        if (_traders[id]) {
+            Trader& trader = *_traders[id];
+            callTrader(trader, CostAccounting::Callback::Settled,
+                       [&]() { trader.notifySettled(); });
+        }
+    }
+}
+
+void Exchange::runAuction()
+{
+    settle(_book.uncross(_auctionAllocation));
+    checkTopOfBook();
+}
+
+void Exchange::setAuctionInterval(round_t rounds, Book::Allocation allocation)
+{
+    if (rounds == 0 && _auctionInterval != 0) {
+        // Stops the last auction triggers must match as they are
+        // placed, or they would rest on a book that stays crossed
+        _book.setMatching(Book::Matching::Continuous);
+        runAuction();
+    }
+    _auctionInterval = rounds;
+    _auctionAllocation = allocation;
+    _book.setMatching(rounds ? Book::Matching::Auction : Book::Matching::Continuous);
+}
+
+void Exchange::tickTraders()
+{
+    ++_round;
+    // Everything queued last round is on the book by now
+    if (_auctionInterval && _round % _auctionInterval == 0) {
+        runAuction();
+    }
+    if (_depthSnapshotInterval && _round % _depthSnapshotInterval == 0) {
+        _marketData.publishDepth(_book, _round);
+    }
+    if (_pollingDisconnected) {
+        std::erase_if(_pollingTraders, [this](trader_id_t id) { return !_traders[id]; });
+        _pollingDisconnected = false;
+    }
+    _ticking.clear();
+    _ticking.insert(_ticking.end(),
+                    _pollingTraders.begin(), _pollingTraders.end());
+    _scheduler.popDue(_round, _ticking);
+    if (_topOfBookChanged) {
+        for (trader_id_t id : _topOfBookSubscribers) {
+            _subscribedTopOfBook[id] = false;
+            _ticking.push_back(id);
+        }
+        _topOfBookSubscribers.clear();
+        _topOfBookChanged = false;
+    }
+    for (trader_id_t id : _ticking) {
+        // The trader may have disconnected since it was scheduled
+        if (_traders[id] && _lastTicked[id] != _round) {
+            _lastTicked[id] = _round;
+            Trader& trader = *_traders[id];
+            callTrader(trader, CostAccounting::Callback::Tick,
+                       [&]() { trader.tick(); });
+        }
+    }
+}
+
+template<typename Call>
+void Exchange::callTrader(Trader& trader, CostAccounting::Callback callback, Call call)
+{
+    if (!_costAccounting) {
+        call();
+        return;
+    }
+    // Read before the call, in case the trader goes away during it
+    trader_id_t id = trader.getId();
+    const std::type_info& type = typeid(trader);
+    auto start = CostAccounting::clock::now();
+    call();
+    _costs.addCall(id, type, callback, CostAccounting::clock::now() - start);
+}
+
+void Exchange::countFor(Trader& trader, std::uint64_t TraderCost::*counter)
+{
+    if (_costAccounting) {
+        ++(_costs.get(trader.getId(), typeid(trader)).*counter);
     }
 }
 
+void Exchange::checkTopOfBook()
+{
+    price_t bestBid = _book.getBestBid();
+    price_t bestOffer = _book.getBestOffer();
+    if (bestBid != _lastBestBid || bestOffer != _lastBestOffer) {
+        _topOfBookChanged = true;
+        _lastBestBid = bestBid;
+        _lastBestOffer = bestOffer;
+    }
+    _marketData.publishTopOfBook(_book, _round);
+}
+
+void Exchange::submitOrder(Trader& trader, Order order, trader_id_t account)
+{
+    assert(_traders[account] == &trader);
+    countFor(trader, &TraderCost::orders);
+    _ledger.lockForOrder(account, order);
+    _orderQueue.push({account, order});
+}
+
 void Exchange::submitOrder(Trader& trader, Order order)
 {
-    _orderQueue.push({&trader, order});
+    submitOrder(trader, order, trader.getId());
+}
+
+bool Exchange::submitCancel(Trader& trader, order_id_t orderid)
+{
+    countFor(trader, &TraderCost::cancels);
+    auto accountItr = _orderToAccountMap.find(orderid);
+    if (accountItr == _orderToAccountMap.end() ||
+        _traders[accountItr->second] != &trader) {
+        return false;
+    }
+    const Order* resting = _book.getOrder(orderid);
+    if (!resting) {
+        return false;
+    }
+    Order cancelled = *resting;
+    _book.cancelOrder(orderid);
+    checkTopOfBook();
+    _ledger.releaseForOrder(accountItr->second, cancelled);
+    _orderToAccountMap.erase(accountItr);
+    trader.notifyCancelled(cancelled);
+    return true;
+}
+
+std::size_t Exchange::submitCancelAll(Trader& trader, trader_id_t account)
+{
+    assert(_traders[account] == &trader);
+    countFor(trader, &TraderCost::cancels);
+    std::vector<Order> cancelled = _book.cancelAllOrders(account);
+    checkTopOfBook();
+    for (const auto& order : cancelled) {
+        _ledger.releaseForOrder(account, order);
+        _orderToAccountMap.erase(order.id);
+        trader.notifyCancelled(order);
+    }
+    return cancelled.size();
+}
+
+std::size_t Exchange::submitCancelAll(Trader& trader)
+{
+    return submitCancelAll(trader, trader.getId());
+}
+
+trader_id_t Exchange::addTrader(Trader* trader, price_t money, quantity_t shares)
+{
+    _traders.push_back(trader);
+    trader_id_t id = _ledger.addAccount(money, shares);
+    assert(id == _traders.size() - 1);
+    _lastTicked.push_back(0);
+    _subscribedTopOfBook.push_back(false);
+    _waitingForSettle.push_back(false);
+    _pollingTraders.push_back(id);
+    return id;
+}
+
+trader_id_t Exchange::addAccount(Trader& trader)
+{
+    return addAccount(trader, TRADER_STARTING_CAPITAL, TRADER_STARTING_POSITION);
+}
+
+trader_id_t Exchange::addAccount(Trader& trader, price_t money, quantity_t shares)
+{
+    assert(_traders.size() && _traders.back() == &trader);
+    _traders.push_back(&trader);
+    trader_id_t id = _ledger.addAccount(money, shares);
+    assert(id == _traders.size() - 1);
+    // Accounts are never ticked themselves, only their trader is
+    _lastTicked.push_back(0);
+    _subscribedTopOfBook.push_back(false);
+    _waitingForSettle.push_back(false);
+    return id;
+}
+
+void Exchange::removeTrader(Trader& trader)
+{
+    // Only the trader's own resting orders are touched here, so
+    // disconnecting doesn't cost more the more others are doing.
+    // Its queued orders and polling entry go once they come up
+    _pollingDisconnected = true;
+    for (trader_id_t account = trader.getId();
+         account < _traders.size() && _traders[account] == &trader;
+         ++account) {
+        for (const auto& order : _book.cancelAllOrders(account)) {
+            _ledger.releaseForOrder(account, order);
+            _orderToAccountMap.erase(order.id);
+        }
+        // Leave the slot empty so that other traders keep their ids
+        _traders[account] = nullptr;
+    }
+    checkTopOfBook();
+}
+
+void Exchange::setPolling(Trader& trader, bool polling)
+{
+    auto itr = std::find(_pollingTraders.begin(), _pollingTraders.end(),
+                         trader.getId());
+    if (polling && itr == _pollingTraders.end()) {
+        _pollingTraders.push_back(trader.getId());
+    } else if (!polling && itr != _pollingTraders.end()) {
+        _pollingTraders.erase(itr);
+    }
+}
+
+void Exchange::scheduleWakeup(Trader& trader, round_t when)
+{
+    _scheduler.schedule(trader.getId(), when);
+}
+
+void Exchange::subscribeTopOfBook(Trader& trader)
+{
+    if (!_subscribedTopOfBook[trader.getId()]) {
+        _subscribedTopOfBook[trader.getId()] = true;
+        _topOfBookSubscribers.push_back(trader.getId());
+    }
+}
+
+void Exchange::deferUntilSettled(Trader& trader)
+{
+    if (!_waitingForSettle[trader.getId()]) {
+        _waitingForSettle[trader.getId()] = true;
+        _settleWaiters.push_back(trader.getId());
+    }
+}
+
+listener_id_t Exchange::addExecutionListener(
+    std::function<void(const Execution&)> listener)
+{
+    _executionListeners.push_back({_nextListener, true, std::move(listener)});
+    return _nextListener++;
+}
+
+void Exchange::removeExecutionListener(listener_id_t listener)
+{
+    for (auto& entry : _executionListeners) {
+        if (entry.id == listener) {
+            entry.active = false;
+        }
+    }
+    if (!_callingListeners) {
+        dropRemovedListeners();
+    }
+}
+
+void Exchange::dropRemovedListeners()
+{
+    std::erase_if(_executionListeners, [](const auto& entry) {
+        return !entry.active;
+    });
 }
 
 void Exchange::draw(Curses& curses)
@@ -65,28 +529,37 @@ void Exchange::draw(Curses& curses)
         curses.drawString(
             "-" + std::to_string(i) + "-",
             10, row);
-        if (i > _book.getBestBid() && i < _book.getBestOffer()) {
-            continue;
+        // Sides are drawn separately, as auctions can leave the book
+        // crossed with both bids and offers at a price
+        if (i <= _book.getBestBid()) {
+            curses.drawString(
+                std::to_string(_book.getQuantityForLevel(Side::Buy, i)),
+                6, row);
+        }
+        if (i >= _book.getBestOffer()) {
+            curses.drawString(
+                std::to_string(_book.getQuantityForLevel(Side::Sell, i)),
+                15, row);
         }
-
-        quantity_t quantity = _book.getQuantityForLevel(i);
-        Side side = _book.getSideForLevel(i);
-        int column = (side == Side::Buy ? 6 : 15);
-        curses.drawString(
-            std::to_string(quantity),
-            column, row);
+    }
+    bool hasMidpoint = _book.hasBid() && _book.hasOffer();
+    if (hasMidpoint) {
+        price_t midpoint = (_book.getBestBid() + _book.getBestOffer())/2;
+        _ledger.markToMarket(midpoint, _valuation);
     }
     for (int i = 0; i < _traders.size() && i < 20; ++i) {
+        if (!_traders[i]) {
+            continue;
+        }
         curses.drawString(
             "Trader " + std::to_string(i) + ":", 20, i + 2);
         curses.drawString(
-            "$" + std::to_string(_traders[i]->getMoney()), 30, i + 2);
+            "$" + std::to_string(_ledger.getMoney(i)), 30, i + 2);
         curses.drawString(
-            "p" + std::to_string(_traders[i]->getShares()), 36, i + 2);
-        if (_book.hasBid() && _book.hasOffer()) {
-            price_t midpoint = (_book.getBestBid() + _book.getBestOffer())/2;
-            curses.drawString("(~$" + 
-                    std::to_string(_traders[i]->getMoney() + midpoint * _traders[i]->getShares()),
+            "p" + std::to_string(_ledger.getShares(i)), 36, i + 2);
+        if (hasMidpoint) {
+            curses.drawString("(~$" +
+                    std::to_string(_valuation.values[i]),
                     42, i + 2);
         }
     }
@@ -0,0 +1,131 @@
+/**
+ * This Trader replays recorded order flow into an exchange. Each
+ * participant in the recording trades from its own account, and
+ * each event is sent on the round it was recorded on, counted from
+ * the round the trader was created
+ */
+
+#pragma once
+
+#include <unordered_map>
+
+#include "Trader.h"
+#include "OrderFlow.h"
+
+class FlowTrader : public Trader
+{
+  public:
+    /// @param reader an open flow file, read as the replay goes
+    /// @param money, shares the balances every participant starts out
+    ///                      with. Recorded orders a participant can't
+    ///                      afford from them are skipped, so these
+    ///                      should cover the recording's prices and sizes
+    FlowTrader(Exchange& exchange, OrderFlowReader& reader,
+               price_t money = TRADER_STARTING_CAPITAL,
+               quantity_t shares = TRADER_STARTING_POSITION);
+
+    void tick() final;
+
+    /// Get the exchange account of a participant in the recording
+    trader_id_t getAccount(std::uint32_t participant) const
+    {
+        // The reader skips records from participants past these
+        assert(participant < _participants);
+        return getId() + participant;
+    }
+    /// Whether every recorded event has been sent
+    bool finished() const { return _next == _batch.size(); }
+    /// Totals so far. Executions and volume aren't known to the trader
+    /// and are left at 0
+    const FlowReplayStats& getStats() const { return _stats; }
+    /// Number of recorded orders not sent because their participant
+    /// couldn't afford them
+    std::uint64_t getSkipped() const { return _skipped; }
+
+  private:
+    /// Move on to the next record, reading another batch if needed
+    void advance();
+
+    OrderFlowReader& _reader;
+    /// Number of participants accounts were opened for
+    std::uint32_t _participants;
+    std::vector<FlowRecord> _batch;
+    std::size_t _next = 0;
+    round_t _startRound;
+    /// Exchange order ids of the recording's orders
+    flow_detail::OrderRefs _orders;
+    /// Size `_orders` is next pruned at
+    std::size_t _pruneAt = 0;
+    FlowReplayStats _stats;
+    std::uint64_t _skipped = 0;
+};
+
+FlowTrader::FlowTrader(Exchange& exchange, OrderFlowReader& reader,
+                       price_t money, quantity_t shares)
+  : Trader(exchange, money, shares), _reader(reader),
+    _participants(std::max<std::uint32_t>(reader.getParticipants(), 1)),
+    _startRound(exchange.getRound())
+{
+    // The trader's own account is the first participant's
+    for (std::uint32_t participant = 1; participant < _participants; ++participant) {
+        _exchange.addAccount(*this, money, shares);
+    }
+    stopPolling();
+    _reader.nextBatch(_batch);
+    if (!finished()) {
+        wakeAfter(_batch[0].round);
+    }
+}
+
+void FlowTrader::tick()
+{
+    const Ledger& ledger = _exchange.getLedger();
+    round_t round = _exchange.getRound();
+    // Everything sent last time has been through the book by now,
+    // so orders that aren't on it have filled or been cancelled
+    flow_detail::pruneOrderRefs(_orders, _exchange.getBook(), _pruneAt);
+    while (!finished() && _startRound + _batch[_next].round <= round) {
+        const FlowRecord& record = _batch[_next];
+        trader_id_t account = getAccount(record.participant);
+        if (record.type == FlowRecord::Type::Order) {
+            Order order(record.side, record.quantity, record.price);
+            bool affordable = order.side == Side::Buy
+                ? order.price * order.quantity <= ledger.getMoney(account) -
+                                                  ledger.getMoneyOutstanding(account)
+                : order.quantity <= ledger.getShares(account) -
+                                    ledger.getSharesOutstanding(account);
+            if (affordable) {
+                _orders[record.ref] = order.id;
+                submitOrder(order, account);
+                ++_stats.orders;
+            } else {
+                ++_skipped;
+            }
+        } else {
+            // Orders only reach the book once the exchange works
+            // through its queue, so an order cancelled on the round
+            // it was sent can't be found yet
+            auto itr = _orders.find(record.ref);
+            if (itr == _orders.end() || !cancelOrder(itr->second)) {
+                ++_stats.missedCancels;
+            }
+            if (itr != _orders.end()) {
+                _orders.erase(itr);
+            }
+            ++_stats.cancels;
+        }
+        advance();
+    }
+    if (!finished()) {
+        wakeAfter(_startRound + _batch[_next].round - round);
+    }
+}
+
+void FlowTrader::advance()
+{
+    if (++_next == _batch.size()) {
+        // An empty batch means the recording is finished
+        _reader.nextBatch(_batch);
+        _next = 0;
+    }
+}
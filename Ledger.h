@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+#include <assert.h>
+
+#include "Order.h"
+
+/// Balances for every trader on an exchange, stored as one array
+/// per field and indexed by trader id, so that whole-market
+/// calculations run as tight loops over contiguous memory
+class Ledger
+{
+  public:
+    /// Result of marking every account to a price
+    struct Valuation
+    {
+        /// Money plus shares marked at the price, per account
+        std::vector<long long> values;
+        /// Value less the starting balances marked at the same
+        /// price, per account
+        std::vector<long long> pnl;
+        /// Total marked value of shares held by all accounts
+        long long exposure = 0;
+    };
+
+    /// Open an account
+    /// @return the index of the account
+    trader_id_t addAccount(price_t money, quantity_t shares);
+    std::size_t size() const { return _money.size(); }
+
+    price_t getMoney(trader_id_t id) const { return _money[id]; }
+    quantity_t getShares(trader_id_t id) const { return _shares[id]; }
+    price_t getMoneyOutstanding(trader_id_t id) const { return _moneyOutstanding[id]; }
+    quantity_t getSharesOutstanding(trader_id_t id) const { return _sharesOutstanding[id]; }
+
+    /// Lock the money or shares needed by a newly submitted order
+    void lockForOrder(trader_id_t id, const Order& order);
+    /// Unlock the money or shares held by a cancelled order
+    void releaseForOrder(trader_id_t id, const Order& order);
+    /// Settle a (perhaps partial) fill of an order
+    void settleTrade(trader_id_t id, const Order& origOrder,
+                     quantity_t quantity, price_t price);
+
+    /// Copy the free money and shares of `count` consecutive accounts
+    void getFreeBalances(trader_id_t first, std::size_t count,
+                         price_t* freeMoney, quantity_t* freeShares) const;
+
+    /// Mark every account to a price in a single pass
+    void markToMarket(price_t mark, Valuation& valuation) const;
+
+  private:
+    // Total amount of money per account
+    std::vector<price_t> _money;
+    // Total number of shares per account
+    std::vector<quantity_t> _shares;
+    // Amount of money locked for unfilled buy orders
+    std::vector<price_t> _moneyOutstanding;
+    // Number of shares locked for unfilled sell orders
+    std::vector<quantity_t> _sharesOutstanding;
+    // Balances each account was opened with
+    std::vector<price_t> _startingMoney;
+    std::vector<quantity_t> _startingShares;
+};
+
+trader_id_t Ledger::addAccount(price_t money, quantity_t shares)
+{
+    _money.push_back(money);
+    _shares.push_back(shares);
+    _moneyOutstanding.push_back(0);
+    _sharesOutstanding.push_back(0);
+    _startingMoney.push_back(money);
+    _startingShares.push_back(shares);
+    return _money.size() - 1;
+}
+
+void Ledger::lockForOrder(trader_id_t id, const Order& order)
+{
+    if (order.side == Side::Buy) {
+        assert(_money[id] - _moneyOutstanding[id] >= order.price * order.quantity);
+        _moneyOutstanding[id] += order.price * order.quantity;
+    } else {
+        assert(_shares[id] - _sharesOutstanding[id] >= order.quantity);
+        _sharesOutstanding[id] += order.quantity;
+    }
+}
+
+void Ledger::releaseForOrder(trader_id_t id, const Order& order)
+{
+    if (order.side == Side::Buy) {
+        _moneyOutstanding[id] -= order.price * order.quantity;
+    } else {
+        _sharesOutstanding[id] -= order.quantity;
+    }
+}
+
+void Ledger::settleTrade(trader_id_t id, const Order& origOrder,
+                         quantity_t quantity, price_t price)
+{
+    if (origOrder.side == Side::Buy) {
+        _money[id] -= quantity * price;
+        _shares[id] += quantity;
+        _moneyOutstanding[id] -= origOrder.price * quantity;
+    } else {
+        _money[id] += quantity * price;
+        _shares[id] -= quantity;
+        _sharesOutstanding[id] -= quantity;
+    }
+}
+
+void Ledger::getFreeBalances(trader_id_t first, std::size_t count,
+                             price_t* freeMoney, quantity_t* freeShares) const
+{
+    assert(first + count <= size());
+    const price_t* money = _money.data() + first;
+    const quantity_t* shares = _shares.data() + first;
+    const price_t* moneyOutstanding = _moneyOutstanding.data() + first;
+    const quantity_t* sharesOutstanding = _sharesOutstanding.data() + first;
+    for (std::size_t i = 0; i < count; ++i) {
+        freeMoney[i] = money[i] - moneyOutstanding[i];
+        freeShares[i] = shares[i] - sharesOutstanding[i];
+    }
+}
+
+void Ledger::markToMarket(price_t mark, Valuation& valuation) const
+{
+    const std::size_t count = size();
+    valuation.values.resize(count);
+    valuation.pnl.resize(count);
+
+    // Plain indexed loops over raw arrays so the compiler
+    // can vectorize them
+    const price_t* money = _money.data();
+    const quantity_t* shares = _shares.data();
+    const price_t* startingMoney = _startingMoney.data();
+    const quantity_t* startingShares = _startingShares.data();
+    long long* values = valuation.values.data();
+    long long* pnl = valuation.pnl.data();
+    const long long price = mark;
+    long long exposure = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        long long held = price * shares[i];
+        values[i] = money[i] + held;
+        pnl[i] = values[i] - startingMoney[i] - price * startingShares[i];
+        exposure += held;
+    }
+    valuation.exposure = exposure;
+}
@@ -0,0 +1,141 @@
+/**
+ * Book state for readers on other threads. The exchange publishes
+ * the top of the book after every change and, if asked, a snapshot
+ * of the whole depth every few rounds. Readers always get consistent
+ * copies, and the exchange never waits for them. The top of the book
+ * is read without locks. Depth readers take a mutex just long enough
+ * to copy a pointer, which the exchange only ever tries to take
+ */
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+
+#include "Book.h"
+#include "Seqlock.h"
+#include "Scheduler.h"
+
+/// Best bid and offer, as `Book::getBestBid` and `getBestOffer`
+/// give them. A side with no orders has a quantity of 0
+struct TopOfBook
+{
+    price_t bid = std::numeric_limits<price_t>::min();
+    quantity_t bidQuantity = 0;
+    price_t offer = std::numeric_limits<price_t>::max();
+    quantity_t offerQuantity = 0;
+    /// Price of the last trade, or 0 if there hasn't been one
+    price_t lastPrice = 0;
+    /// Round the top of the book last changed on
+    round_t round = 0;
+
+    bool hasBid() const { return bidQuantity != 0; }
+    bool hasOffer() const { return offerQuantity != 0; }
+};
+
+/// Every level of the book at one moment. Snapshots are never
+/// changed once published
+struct DepthSnapshot
+{
+    round_t round = 0;
+    price_t lastPrice = 0;
+    /// Best price first
+    std::vector<Book::DepthLevel> bids;
+    std::vector<Book::DepthLevel> offers;
+};
+
+class MarketData
+{
+  public:
+    MarketData() : _depth(std::make_shared<const DepthSnapshot>()) {}
+    MarketData(const MarketData&) = delete;
+    MarketData& operator=(const MarketData&) = delete;
+
+    /// Get the latest top of the book. Safe from any thread
+    TopOfBook getTopOfBook() const { return _topOfBook.read(); }
+    /// Number of times the top of the book has been published
+    std::uint64_t getTopOfBookVersion() const { return _topOfBook.version(); }
+    /// Get the latest depth snapshot, which stays valid for as long
+    /// as it is held. Safe from any thread
+    std::shared_ptr<const DepthSnapshot> getDepth() const
+    {
+        std::lock_guard<std::mutex> lock(_depthMutex);
+        return _depth;
+    }
+
+    /// Publish the top of a book. Only the exchange's thread may publish
+    void publishTopOfBook(const Book& book, round_t round);
+    /// Publish a snapshot of a book's depth. If a reader is busy taking
+    /// the last one, it is left pending rather than waiting
+    void publishDepth(const Book& book, round_t round);
+    /// Try again to publish a pending depth snapshot
+    void publishPendingDepth();
+    bool hasPendingDepth() const { return _pendingDepth != nullptr; }
+
+  private:
+    Seqlock<TopOfBook> _topOfBook;
+    /// Only held long enough to copy `_depth`, and never waited
+    /// on by the publisher
+    mutable std::mutex _depthMutex;
+    std::shared_ptr<const DepthSnapshot> _depth;
+    /// A snapshot that couldn't be published yet
+    std::shared_ptr<const DepthSnapshot> _pendingDepth;
+    /// What the exchange's thread last published
+    TopOfBook _published;
+    /// Reused between publishes to avoid reallocating
+    std::vector<Book::DepthLevel> _best;
+};
+
+void MarketData::publishTopOfBook(const Book& book, round_t round)
+{
+    TopOfBook top;
+    // Looked up by side, as the book may be crossed during auctions
+    book.getDepth(Side::Buy, _best, 1);
+    if (_best.size()) {
+        top.bid = _best[0].price;
+        top.bidQuantity = _best[0].quantity;
+    }
+    book.getDepth(Side::Sell, _best, 1);
+    if (_best.size()) {
+        top.offer = _best[0].price;
+        top.offerQuantity = _best[0].quantity;
+    }
+    top.lastPrice = book.getLastPrice();
+    // Most changes to the book are behind the top of it,
+    // and readers needn't see those
+    if (top.bid == _published.bid && top.bidQuantity == _published.bidQuantity &&
+        top.offer == _published.offer && top.offerQuantity == _published.offerQuantity &&
+        top.lastPrice == _published.lastPrice) {
+        return;
+    }
+    top.round = round;
+    _published = top;
+    _topOfBook.write(top);
+}
+
+void MarketData::publishDepth(const Book& book, round_t round)
+{
+    // Built off to the side, so readers only ever see finished snapshots
+    auto snapshot = std::make_shared<DepthSnapshot>();
+    snapshot->round = round;
+    snapshot->lastPrice = book.getLastPrice();
+    book.getDepth(Side::Buy, snapshot->bids);
+    book.getDepth(Side::Sell, snapshot->offers);
+    _pendingDepth = std::move(snapshot);
+    publishPendingDepth();
+}
+
+void MarketData::publishPendingDepth()
+{
+    {
+        std::unique_lock<std::mutex> lock(_depthMutex, std::try_to_lock);
+        if (!lock) {
+            return;
+        }
+        _depth.swap(_pendingDepth);
+    }
+    // The old snapshot is freed here if no reader holds
+    // it, outside the lock
+    _pendingDepth.reset();
+}
@@ -5,16 +5,66 @@ using quantity_t = unsigned int;
 enum class Side {Buy, Sell};
 
 using order_id_t = unsigned int;
-static order_id_t gid;
+
+/// Hands out order ids. Orders take their id from the source that is
+/// current on their thread, so simulations that each install their
+/// own can run side by side
+class OrderIdSource
+{
+  public:
+    order_id_t next() { return _next++; }
+
+    /// Get the source that is current on this thread
+    static OrderIdSource& current() { return *currentSlot(); }
+
+    /// Makes a source current on this thread for its lifetime
+    class Scope
+    {
+      public:
+        explicit Scope(OrderIdSource& source)
+          : _previous(currentSlot())
+        {
+            currentSlot() = &source;
+        }
+        ~Scope() { currentSlot() = _previous; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+      private:
+        OrderIdSource* _previous;
+    };
+
+  private:
+    static OrderIdSource*& currentSlot()
+    {
+        static thread_local OrderIdSource fallback;
+        static thread_local OrderIdSource* current = &fallback;
+        return current;
+    }
+
+    order_id_t _next = 0;
+};
+
+using trader_id_t = unsigned int;
+/// Owner of orders that do not belong to any trader
+static constexpr trader_id_t NO_TRADER = ~0u;
 
 struct Order
 {
     Order(Side _side, quantity_t _quantity, price_t _price)
-      : side(_side), quantity(_quantity), price(_price), id(gid++) {}
+      : side(_side), quantity(_quantity), price(_price), id(OrderIdSource::current().next()) {}
     Side side;
+    /// Quantity left to trade, including any hidden quantity
     quantity_t quantity;
     price_t price;
     order_id_t id;
+    /// For iceberg orders, the most quantity shown on the book at a
+    /// time. The rest is shown as what is shown trades. 0 shows it all
+    quantity_t displayQuantity = 0;
+    /// For stop orders, the last trade price that turns the order
+    /// into a limit order at `price`: buy stops trigger on trades at
+    /// or above it, sell stops at or below. 0 for other orders
+    price_t stopPrice = 0;
 
     /// Why C++ decided to make us define this is dumb af
     bool operator==(const Order& other) const
@@ -22,6 +72,8 @@ struct Order
         return side == other.side &&
                quantity == other.quantity &&
                price == other.price &&
-               id == other.id;
+               id == other.id &&
+               displayQuantity == other.displayQuantity &&
+               stopPrice == other.stopPrice;
     };
 };
\ No newline at end of file
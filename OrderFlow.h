@@ -0,0 +1,493 @@
+/**
+ * Recorded order flow. Flow is stored as a small header followed by
+ * fixed size binary records, and is read back by memory mapping the
+ * file and decoding it in batches, so hours of flow can be replayed
+ * into a `Book` (or an `Exchange`, see `FlowTrader`) at disk speed
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <istream>
+#include <sstream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Book.h"
+
+/// One recorded event
+struct FlowRecord
+{
+    enum class Type : std::uint8_t {Order, Cancel};
+
+    /// Round the event happened on
+    std::uint32_t round;
+    /// The recording's id for the order. Cancels refer to the
+    /// order they cancel by this
+    std::uint32_t ref;
+    /// Who sent the event, numbered from 0
+    std::uint32_t participant;
+    quantity_t quantity;
+    price_t price;
+    Type type;
+    Side side;
+};
+
+/// File layout: the header, then `count` records of `RECORD_SIZE`
+/// bytes each. Everything is little endian
+static constexpr char FLOW_MAGIC[8] = {'E', 'X', 'F', 'L', 'O', 'W', '0', '1'};
+static constexpr std::size_t FLOW_HEADER_SIZE = 24;
+static constexpr std::size_t FLOW_RECORD_SIZE = 24;
+/// Participants are numbered densely from 0, and replaying flow into
+/// an exchange opens an account for each, so a recording has at most
+/// this many
+static constexpr std::uint32_t FLOW_MAX_PARTICIPANTS = 1 << 20;
+
+/// Writes recorded flow to a file
+class OrderFlowWriter
+{
+  public:
+    OrderFlowWriter() = default;
+    ~OrderFlowWriter() { close(); }
+    OrderFlowWriter(const OrderFlowWriter&) = delete;
+    OrderFlowWriter& operator=(const OrderFlowWriter&) = delete;
+
+    /// @return if the file could be created
+    bool open(const std::string& path);
+    /// Write a record. One from a participant at or past
+    /// `FLOW_MAX_PARTICIPANTS` is dropped, and fails the file
+    void write(const FlowRecord& record);
+    /// Fill in the header and close the file
+    /// @return if everything was written
+    bool close();
+
+    std::uint64_t getCount() const { return _count; }
+
+  private:
+    void writeHeader();
+
+    std::FILE* _file = nullptr;
+    std::uint64_t _count = 0;
+    std::uint32_t _participants = 0;
+    bool _failed = false;
+};
+
+/// Reads recorded flow from a memory mapped file
+class OrderFlowReader
+{
+  public:
+    /// @param batchSize number of records decoded at a time
+    explicit OrderFlowReader(std::size_t batchSize = 4096)
+      : _batchSize(batchSize) {}
+    ~OrderFlowReader() { close(); }
+    OrderFlowReader(const OrderFlowReader&) = delete;
+    OrderFlowReader& operator=(const OrderFlowReader&) = delete;
+
+    /// @return if the file exists and is a valid flow file, with
+    ///         no more than `FLOW_MAX_PARTICIPANTS` participants
+    bool open(const std::string& path);
+    void close();
+
+    /// Decode the next batch of records into `batch`, replacing its
+    /// contents, and ask the OS to start reading the batches after it.
+    /// Malformed records are skipped, so every record given is one a
+    /// book will take, from a participant under `getParticipants`
+    /// @return if any records were read
+    bool nextBatch(std::vector<FlowRecord>& batch);
+
+    /// Number of records in the file, malformed ones included
+    std::uint64_t getCount() const { return _count; }
+    /// Number of distinct participants, one more than the highest
+    std::uint32_t getParticipants() const { return _participants; }
+    /// Number of records skipped so far because they were malformed
+    std::uint64_t getMalformed() const { return _malformed; }
+
+  private:
+    std::size_t _batchSize;
+    const unsigned char* _data = nullptr;
+    std::size_t _size = 0;
+    std::uint64_t _count = 0;
+    std::uint32_t _participants = 0;
+    std::uint64_t _next = 0;
+    std::uint64_t _malformed = 0;
+};
+
+/// Totals from replaying flow into a book
+struct FlowReplayStats
+{
+    std::uint64_t orders = 0;
+    std::uint64_t cancels = 0;
+    /// Cancels for orders that were no longer on the book
+    std::uint64_t missedCancels = 0;
+    std::uint64_t executions = 0;
+    std::uint64_t volume = 0;
+};
+
+/// Import flow from CSV, one event per line, as
+/// `round,type,participant,ref,side,quantity,price`, where type is
+/// `order` or `cancel` and side is `buy` or `sell`. Cancels may leave
+/// side, quantity and price empty. A header line is skipped.
+/// Participants may be any ids, such as account numbers, and are
+/// renumbered from 0 in the order they first appear
+/// @param badLines if given, set to the number of lines skipped
+///                 because they couldn't be parsed, or had a
+///                 participant past `FLOW_MAX_PARTICIPANTS`
+/// @param participantIds if given, set to the CSV's id for each
+///                       participant, indexed by its new number
+/// @return the number of records written
+std::uint64_t importCsv(std::istream& in, OrderFlowWriter& out,
+                        std::uint64_t* badLines = nullptr,
+                        std::vector<std::uint32_t>* participantIds = nullptr);
+
+/// Feed every record in a flow file straight into a book.
+/// Participants are used as the owners of their orders
+FlowReplayStats replayIntoBook(OrderFlowReader& reader, Book& book);
+
+namespace flow_detail
+{
+    inline void put32(unsigned char* out, std::uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i) {
+            out[i] = value >> (8 * i);
+        }
+    }
+
+    inline std::uint32_t get32(const unsigned char* in)
+    {
+        return in[0] | (in[1] << 8) | (in[2] << 16) |
+               (static_cast<std::uint32_t>(in[3]) << 24);
+    }
+
+    /// Map from the recording's order refs to book order ids
+    using OrderRefs = std::unordered_map<std::uint32_t,order_id_t>;
+
+    /// Drop the orders that are no longer on a book, once there are
+    /// `pruneAt` of them, so the map grows with the orders resting
+    /// rather than with every order sent
+    inline void pruneOrderRefs(OrderRefs& orders, const Book& book, std::size_t& pruneAt)
+    {
+        if (orders.size() < pruneAt) {
+            return;
+        }
+        std::erase_if(orders, [&book](const auto& entry) {
+            return book.getOrder(entry.second) == nullptr;
+        });
+        pruneAt = std::max<std::size_t>(1024, 2 * orders.size());
+    }
+}
+
+bool OrderFlowWriter::open(const std::string& path)
+{
+    close();
+    _file = std::fopen(path.c_str(), "wb");
+    if (!_file) {
+        return false;
+    }
+    _count = 0;
+    _participants = 0;
+    _failed = false;
+    // Written again with the real counts on close
+    writeHeader();
+    return !_failed;
+}
+
+void OrderFlowWriter::write(const FlowRecord& record)
+{
+    assert(_file);
+    using namespace flow_detail;
+    if (record.participant >= FLOW_MAX_PARTICIPANTS) {
+        _failed = true;
+        return;
+    }
+    unsigned char out[FLOW_RECORD_SIZE] = {};
+    put32(out, record.round);
+    put32(out + 4, record.ref);
+    put32(out + 8, record.participant);
+    put32(out + 12, record.quantity);
+    put32(out + 16, record.price);
+    out[20] = static_cast<unsigned char>(record.type);
+    out[21] = static_cast<unsigned char>(record.side);
+    if (std::fwrite(out, sizeof(out), 1, _file) != 1) {
+        _failed = true;
+    }
+    ++_count;
+    _participants = std::max(_participants, record.participant + 1);
+}
+
+bool OrderFlowWriter::close()
+{
+    if (!_file) {
+        return !_failed;
+    }
+    if (std::fseek(_file, 0, SEEK_SET) != 0) {
+        _failed = true;
+    }
+    writeHeader();
+    if (std::fclose(_file) != 0) {
+        _failed = true;
+    }
+    _file = nullptr;
+    return !_failed;
+}
+
+void OrderFlowWriter::writeHeader()
+{
+    using namespace flow_detail;
+    unsigned char out[FLOW_HEADER_SIZE] = {};
+    std::memcpy(out, FLOW_MAGIC, sizeof(FLOW_MAGIC));
+    put32(out + 8, static_cast<std::uint32_t>(_count));
+    put32(out + 12, static_cast<std::uint32_t>(_count >> 32));
+    put32(out + 16, _participants);
+    if (std::fwrite(out, sizeof(out), 1, _file) != 1) {
+        _failed = true;
+    }
+}
+
+bool OrderFlowReader::open(const std::string& path)
+{
+    using namespace flow_detail;
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 ||
+        static_cast<std::size_t>(info.st_size) < FLOW_HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    _size = info.st_size;
+    void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        _size = 0;
+        return false;
+    }
+    _data = static_cast<const unsigned char*>(data);
+    madvise(data, _size, MADV_SEQUENTIAL);
+
+    _count = get32(_data + 8) | (static_cast<std::uint64_t>(get32(_data + 12)) << 32);
+    _participants = get32(_data + 16);
+    _next = 0;
+    _malformed = 0;
+    // Divided rather than multiplied out, as a corrupt count could overflow
+    if (std::memcmp(_data, FLOW_MAGIC, sizeof(FLOW_MAGIC)) != 0 ||
+        _count > (_size - FLOW_HEADER_SIZE) / FLOW_RECORD_SIZE ||
+        (_count != 0 && _participants == 0) ||
+        _participants > FLOW_MAX_PARTICIPANTS) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void OrderFlowReader::close()
+{
+    if (_data) {
+        munmap(const_cast<unsigned char*>(_data), _size);
+    }
+    _data = nullptr;
+    _size = 0;
+    _count = 0;
+    _participants = 0;
+    _next = 0;
+    _malformed = 0;
+}
+
+bool OrderFlowReader::nextBatch(std::vector<FlowRecord>& batch)
+{
+    using namespace flow_detail;
+    batch.clear();
+    // A batch of nothing but malformed records would look like the
+    // end of the file, so carry on to the next
+    while (batch.empty() && _data && _next != _count) {
+        std::uint64_t end = std::min<std::uint64_t>(_count, _next + _batchSize);
+
+        // Have the OS page in the next couple of batches
+        // while this one is decoded
+        static const std::size_t page = sysconf(_SC_PAGESIZE);
+        std::size_t ahead = FLOW_HEADER_SIZE + end * FLOW_RECORD_SIZE;
+        std::size_t aheadEnd = std::min(_size,
+            ahead + 2 * _batchSize * FLOW_RECORD_SIZE);
+        std::size_t aheadStart = ahead / page * page;
+        if (aheadStart < aheadEnd) {
+            madvise(const_cast<unsigned char*>(_data) + aheadStart,
+                    aheadEnd - aheadStart, MADV_WILLNEED);
+        }
+
+        batch.resize(end - _next);
+        std::size_t kept = 0;
+        const unsigned char* in = _data + FLOW_HEADER_SIZE + _next * FLOW_RECORD_SIZE;
+        for (std::uint64_t i = _next; i < end; ++i, in += FLOW_RECORD_SIZE) {
+            FlowRecord& record = batch[kept];
+            record.round = get32(in);
+            record.ref = get32(in + 4);
+            record.participant = get32(in + 8);
+            record.quantity = get32(in + 12);
+            record.price = get32(in + 16);
+            record.type = static_cast<FlowRecord::Type>(in[20]);
+            record.side = static_cast<Side>(in[21]);
+            // Orders must be ones a book takes. Cancels only need a ref
+            bool valid = record.participant < _participants &&
+                (in[20] == static_cast<unsigned char>(FlowRecord::Type::Cancel) ||
+                 (in[20] == static_cast<unsigned char>(FlowRecord::Type::Order) &&
+                  in[21] <= static_cast<unsigned char>(Side::Sell) &&
+                  record.quantity != 0 && record.price != 0));
+            if (valid) {
+                ++kept;
+            } else {
+                ++_malformed;
+            }
+        }
+        batch.resize(kept);
+        _next = end;
+    }
+    return !batch.empty();
+}
+
+std::uint64_t importCsv(std::istream& in, OrderFlowWriter& out,
+                        std::uint64_t* badLines,
+                        std::vector<std::uint32_t>* participantIds)
+{
+    std::unordered_map<std::uint32_t,std::uint32_t> participants;
+    std::vector<std::uint32_t> ids;
+    std::uint64_t written = 0;
+    std::uint64_t bad = 0;
+    std::string line;
+    bool first = true;
+    while (std::getline(in, line)) {
+        if (line.size() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, ',')) {
+            fields.push_back(field);
+        }
+        while (fields.size() < 7) {
+            fields.push_back("");
+        }
+
+        FlowRecord record = {};
+        bool ok = fields.size() == 7;
+        auto number = [&](const std::string& text, std::uint32_t& value) {
+            // strtoul takes a sign and wraps negatives around, and
+            // the fields are only 32 bits wide
+            char* end = nullptr;
+            errno = 0;
+            unsigned long parsed = std::strtoul(text.c_str(), &end, 10);
+            if (text.empty() || text.find('-') != std::string::npos || *end != '\0' ||
+                errno == ERANGE || parsed > UINT32_MAX) {
+                ok = false;
+            }
+            value = parsed;
+        };
+        number(fields[0], record.round);
+        number(fields[2], record.participant);
+        number(fields[3], record.ref);
+        if (fields[1] == "order") {
+            record.type = FlowRecord::Type::Order;
+            if (fields[4] == "buy") {
+                record.side = Side::Buy;
+            } else if (fields[4] == "sell") {
+                record.side = Side::Sell;
+            } else {
+                ok = false;
+            }
+            number(fields[5], record.quantity);
+            number(fields[6], record.price);
+            ok = ok && record.quantity != 0 && record.price != 0;
+        } else if (fields[1] == "cancel") {
+            record.type = FlowRecord::Type::Cancel;
+        } else {
+            ok = false;
+        }
+        if (ok) {
+            // Renumbered, so ids like account numbers don't leave a
+            // replay opening an account for every id below them
+            auto found = participants.find(record.participant);
+            if (found != participants.end()) {
+                record.participant = found->second;
+            } else if (ids.size() < FLOW_MAX_PARTICIPANTS) {
+                participants.emplace(record.participant, ids.size());
+                ids.push_back(record.participant);
+                record.participant = ids.size() - 1;
+            } else {
+                ok = false;
+            }
+        }
+
+        if (!ok) {
+            // Only the first line may be a header
+            if (!first) {
+                ++bad;
+            }
+            first = false;
+            continue;
+        }
+        first = false;
+        out.write(record);
+        ++written;
+    }
+    if (badLines) {
+        *badLines = bad;
+    }
+    if (participantIds) {
+        *participantIds = std::move(ids);
+    }
+    return written;
+}
+
+FlowReplayStats replayIntoBook(OrderFlowReader& reader, Book& book)
+{
+    FlowReplayStats stats;
+    flow_detail::OrderRefs orders;
+    std::size_t pruneAt = 0;
+    std::vector<FlowRecord> batch;
+    while (reader.nextBatch(batch)) {
+        for (const auto& record : batch) {
+            if (record.type == FlowRecord::Type::Order) {
+                Order order(record.side, record.quantity, record.price);
+                for (const auto& exec : book.addOrder(order, record.participant)) {
+                    ++stats.executions;
+                    stats.volume += exec.quantity;
+                }
+                if (book.getOrder(order.id)) {
+                    flow_detail::pruneOrderRefs(orders, book, pruneAt);
+                    orders[record.ref] = order.id;
+                } else {
+                    // Filled straight away, so there's nothing to cancel
+                    orders.erase(record.ref);
+                }
+                ++stats.orders;
+            } else {
+                auto itr = orders.find(record.ref);
+                if (itr == orders.end() || !book.cancelOrder(itr->second)) {
+                    ++stats.missedCancels;
+                }
+                if (itr != orders.end()) {
+                    orders.erase(itr);
+                }
+                ++stats.cancels;
+            }
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,220 @@
+/**
+ * This Trader stands in for a whole population of identical
+ * agents. Each agent has its own account on the exchange, but the
+ * agents' decisions are made together each tick, as loops over
+ * arrays, instead of one virtual call and a few random draws per agent
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "Trader.h"
+#include "BatchRandom.h"
+
+/// Parameters shared by every agent in a population
+struct PopulationParameters
+{
+    /// Chance each random agent trades on a tick
+    double tradeChance = .1;
+    /// Largest quantity a random limit agent trades, and the
+    /// quantity a random market agent always trades
+    quantity_t maxQuantity = 10;
+    /// Largest price a random limit agent trades at
+    price_t maxPrice = MARKET_MAX_PRICE;
+    /// Price dealer agents quote around
+    price_t midpoint = (MARKET_MAX_PRICE - MARKET_MIN_PRICE) / 2;
+    /// Distance of dealer agents' quotes from the midpoint
+    price_t spread = 2;
+};
+
+class PopulationTrader : public Trader
+{
+  public:
+    /// What every agent in the population does, matching
+    /// `RandomTrader`, `RandomMarketOrderTrader` and `DealerTrader`
+    enum class Behaviour {RandomLimit, RandomMarket, Dealer};
+
+    /// Create a population whose generators are seeded
+    /// from the exchange's random numbers
+    PopulationTrader(Exchange& exchange, Behaviour behaviour,
+                     std::size_t agents,
+                     PopulationParameters parameters = PopulationParameters());
+    PopulationTrader(Exchange& exchange, Behaviour behaviour,
+                     std::size_t agents, PopulationParameters parameters,
+                     std::uint64_t seed);
+
+    void tick() final;
+
+    /// Number of agents in the population
+    std::size_t size() const { return _wanted.size(); }
+    /// Get the exchange account of an agent
+    trader_id_t getAccount(std::size_t agent) const { return getId() + agent; }
+
+  private:
+    /// A random agent's order, before it is checked against its balances
+    struct RandomOrder
+    {
+        /// 1 for sell
+        std::uint32_t sell;
+        std::uint32_t price;
+        std::uint32_t quantity;
+    };
+
+    /// Work out a random agent's order from its draw
+    static RandomOrder randomOrder(std::uint32_t draw, std::uint32_t market,
+                                   std::uint32_t maxPrice, std::uint32_t maxQuantity);
+    /// Decide which random agents trade this tick
+    void decideRandom();
+    /// Decide which dealer agents can quote each side
+    void decideDealer();
+
+    Behaviour _behaviour;
+    PopulationParameters _parameters;
+    /// Random agents trade when their draw is under this
+    std::uint32_t _tradeThreshold;
+    BatchRandom _random;
+
+    // Per-agent scratch space, reused every tick
+    std::vector<std::uint32_t> _tradeDraw;
+    std::vector<std::uint32_t> _orderDraw;
+    std::vector<price_t> _freeMoney;
+    std::vector<quantity_t> _freeShares;
+    /// Whether each agent places its order. Dealers use `_wanted` for
+    /// their bid and `_wantedSell` for their offer. Orders themselves
+    /// are only worked out for the agents that place them
+    std::vector<std::uint8_t> _wanted;
+    std::vector<std::uint8_t> _wantedSell;
+};
+
+PopulationTrader::PopulationTrader(Exchange& exchange, Behaviour behaviour,
+                                   std::size_t agents,
+                                   PopulationParameters parameters)
+  : PopulationTrader(exchange, behaviour, agents, parameters,
+                     exchange.getRandom()()) {}
+
+PopulationTrader::PopulationTrader(Exchange& exchange, Behaviour behaviour,
+                                   std::size_t agents,
+                                   PopulationParameters parameters,
+                                   std::uint64_t seed)
+  : Trader(exchange), _behaviour(behaviour), _parameters(parameters),
+    _random(agents, seed),
+    _tradeDraw(agents), _orderDraw(agents),
+    _freeMoney(agents), _freeShares(agents),
+    _wanted(agents), _wantedSell(agents)
+{
+    assert(agents > 0);
+    // The trader's own account is the first agent's
+    for (std::size_t agent = 1; agent < agents; ++agent) {
+        _exchange.addAccount(*this);
+    }
+    double threshold = std::max(parameters.tradeChance, 0.0) * 4294967296.0;
+    _tradeThreshold = threshold >= 4294967295.0
+        ? 4294967295u : static_cast<std::uint32_t>(threshold);
+}
+
+void PopulationTrader::tick()
+{
+    _exchange.getLedger().getFreeBalances(getId(), size(),
+                                          _freeMoney.data(),
+                                          _freeShares.data());
+    if (_behaviour != Behaviour::Dealer) {
+        decideRandom();
+        // Only the agents that trade pay for an order
+        const std::uint32_t market = _behaviour == Behaviour::RandomMarket;
+        for (std::size_t agent = 0; agent < size(); ++agent) {
+            if (_wanted[agent]) {
+                RandomOrder order = randomOrder(_orderDraw[agent], market,
+                                                _parameters.maxPrice,
+                                                _parameters.maxQuantity);
+                submitOrder({order.sell ? Side::Sell : Side::Buy,
+                             order.quantity, order.price},
+                            getAccount(agent));
+            }
+        }
+        return;
+    }
+    decideDealer();
+    price_t buyPrice = _parameters.midpoint - _parameters.spread;
+    price_t sellPrice = _parameters.midpoint + _parameters.spread;
+    for (std::size_t agent = 0; agent < size(); ++agent) {
+        if (_wanted[agent]) {
+            submitOrder({Side::Buy, _freeMoney[agent] / buyPrice, buyPrice},
+                        getAccount(agent));
+        }
+    }
+    for (std::size_t agent = 0; agent < size(); ++agent) {
+        if (_wantedSell[agent]) {
+            submitOrder({Side::Sell, _freeShares[agent], sellPrice},
+                        getAccount(agent));
+        }
+    }
+}
+
+PopulationTrader::RandomOrder PopulationTrader::randomOrder(
+    std::uint32_t draw, std::uint32_t market,
+    std::uint32_t maxPrice, std::uint32_t maxQuantity)
+{
+    // Low bit picks the side, and the next two 15 bit fields are
+    // scaled into the price and quantity ranges. Market orders go at
+    // the far end of the price range
+    RandomOrder order;
+    order.sell = draw & 1;
+    std::uint32_t marketPrice = MARKET_MAX_PRICE -
+        ((MARKET_MAX_PRICE - MARKET_MIN_PRICE) & (0u - order.sell));
+    std::uint32_t limitPrice = 1 + ((((draw >> 1) & 0x7fff) * maxPrice) >> 15);
+    std::uint32_t limitQuantity = 1 + ((((draw >> 16) & 0x7fff) * maxQuantity) >> 15);
+    order.price = market ? marketPrice : limitPrice;
+    order.quantity = market ? maxQuantity : limitQuantity;
+    return order;
+}
+
+void PopulationTrader::decideRandom()
+{
+    _random.next(_tradeDraw.data());
+    _random.next(_orderDraw.data());
+
+    // The loop writes nothing but `wanted`, and reads nothing but
+    // locals and the arrays, so the compiler can tell the arrays apart
+    // and the trip count fixed, and vectorizes it. Check with
+    // -fopt-info-vec after changing it
+    const std::size_t agents = size();
+    const std::uint32_t market = _behaviour == Behaviour::RandomMarket;
+    const std::uint32_t threshold = _tradeThreshold;
+    const std::uint32_t maxPrice = _parameters.maxPrice;
+    const std::uint32_t maxQuantity = _parameters.maxQuantity;
+    const std::uint32_t* tradeDraw = _tradeDraw.data();
+    const std::uint32_t* orderDraw = _orderDraw.data();
+    const price_t* freeMoney = _freeMoney.data();
+    const quantity_t* freeShares = _freeShares.data();
+    std::uint8_t* wanted = _wanted.data();
+    for (std::size_t i = 0; i < agents; ++i) {
+        RandomOrder order = randomOrder(orderDraw[i], market, maxPrice, maxQuantity);
+        // Selects between the sides are done with masks over both
+        // balances, as branches would stop the loop vectorizing
+        std::uint32_t sellMask = 0u - order.sell;
+        std::uint32_t needed = (order.quantity & sellMask) |
+                               (order.price * order.quantity & ~sellMask);
+        std::uint32_t available = (freeShares[i] & sellMask) |
+                                  (freeMoney[i] & ~sellMask);
+        wanted[i] = (tradeDraw[i] < threshold) & (needed <= available);
+    }
+}
+
+void PopulationTrader::decideDealer()
+{
+    // Quantities need a division, which doesn't vectorize, so they
+    // are left to the agents that quote
+    const std::size_t agents = size();
+    const price_t buyPrice = _parameters.midpoint - _parameters.spread;
+    const price_t* freeMoney = _freeMoney.data();
+    const quantity_t* freeShares = _freeShares.data();
+    std::uint8_t* wanted = _wanted.data();
+    std::uint8_t* wantedSell = _wantedSell.data();
+    for (std::size_t i = 0; i < agents; ++i) {
+        wanted[i] = freeMoney[i] >= buyPrice;
+        wantedSell[i] = freeShares[i] > 0;
+    }
+}
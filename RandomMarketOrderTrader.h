@@ -12,15 +12,18 @@ class RandomMarketOrderTrader : public Trader
                             double _tradeChance = .1,
                             quantity_t _tradeQuantity = 10)
       : Trader(exchange), tradeChance(_tradeChance),
-        tradeQuantity(_tradeQuantity) {}
+        tradeQuantity(_tradeQuantity)
+    {
+        stopPolling();
+        wakeAtNextArrival(tradeChance);
+    }
 
     void tick() final
     {
-        if (rand() / (RAND_MAX + 1.0) < tradeChance) {
-            Side side = (rand() % 2) == 0 ? Side::Buy : Side::Sell;
-            price_t price = side == Side::Buy ? MARKET_MAX_PRICE : MARKET_MIN_PRICE;
-            submitOrder({side, tradeQuantity, price});
-        }
+        wakeAtNextArrival(tradeChance);
+        Side side = (random() % 2) == 0 ? Side::Buy : Side::Sell;
+        price_t price = side == Side::Buy ? MARKET_MAX_PRICE : MARKET_MIN_PRICE;
+        submitOrder({side, tradeQuantity, price});
     }
 
   private:
@@ -14,22 +14,25 @@ class RandomTrader : public Trader
                             price_t _maxPrice = MARKET_MAX_PRICE)
       : Trader(exchange), tradeChance(_tradeChance),
         maxQuantity(_maxQuantity),
-        maxPrice(_maxPrice) {}
+        maxPrice(_maxPrice)
+    {
+        stopPolling();
+        wakeAtNextArrival(tradeChance);
+    }
 
     void tick() final
     {
-        if (rand() / (RAND_MAX + 1.0) < tradeChance) {
-            Side side = (rand() % 2) == 0 ? Side::Buy : Side::Sell;
-            price_t price = (rand() % maxPrice) + 1;
-            quantity_t quantity = (rand() % maxQuantity) + 1;
-            if (side == Side::Buy && price * quantity > getFreeMoney()) {
-                return;
-            }
-            if (side == Side::Sell && quantity > getFreeShares()) {
-                return;
-            }
-            submitOrder({side, quantity, price});
+        wakeAtNextArrival(tradeChance);
+        Side side = (random() % 2) == 0 ? Side::Buy : Side::Sell;
+        price_t price = (random() % maxPrice) + 1;
+        quantity_t quantity = (random() % maxQuantity) + 1;
+        if (side == Side::Buy && price * quantity > getFreeMoney()) {
+            return;
+        }
+        if (side == Side::Sell && quantity > getFreeShares()) {
+            return;
         }
+        submitOrder({side, quantity, price});
     }
 
   private:
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "Order.h"
+
+/// The exchange clock. One round passes each time the
+/// exchange runs out of orders and wakes traders up
+using round_t = unsigned long long;
+
+/// A hashed timing wheel of trader wakeups. Wakeups are bucketed
+/// by round modulo the number of slots, so advancing the clock only
+/// looks at the wakeups that might be due
+class Scheduler
+{
+  public:
+    explicit Scheduler(std::size_t slots = 256) : _slots(slots) {}
+
+    /// Wake a trader at a round. Rounds that have already
+    /// passed are moved to the next round
+    void schedule(trader_id_t trader, round_t when);
+    /// Advance the clock to `now`, collecting the traders that are
+    /// due. Rounds must be visited in order without skipping any
+    void popDue(round_t now, std::vector<trader_id_t>& due);
+
+    /// Number of wakeups still pending
+    std::size_t size() const { return _size; }
+
+  private:
+    struct Wakeup
+    {
+        round_t when;
+        trader_id_t trader;
+    };
+
+    std::vector<std::vector<Wakeup>> _slots;
+    std::size_t _size = 0;
+    round_t _now = 0;
+};
+
+void Scheduler::schedule(trader_id_t trader, round_t when)
+{
+    when = std::max(when, _now + 1);
+    _slots[when % _slots.size()].push_back({when, trader});
+    ++_size;
+}
+
+void Scheduler::popDue(round_t now, std::vector<trader_id_t>& due)
+{
+    _now = now;
+    auto& slot = _slots[now % _slots.size()];
+    // Wakeups further out than one turn of the wheel share the
+    // slot, and stay behind
+    std::size_t i = 0;
+    while (i < slot.size()) {
+        if (slot[i].when == now) {
+            due.push_back(slot[i].trader);
+            slot[i] = slot.back();
+            slot.pop_back();
+            --_size;
+        } else {
+            ++i;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+/**
+ * A sequence lock around a small value. One thread writes the value
+ * and never waits; any number of threads read it, retrying if a write
+ * happened while they were copying it
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+template <typename T>
+class Seqlock
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert(std::is_default_constructible_v<T>);
+
+  public:
+    explicit Seqlock(const T& value = T());
+    Seqlock(const Seqlock&) = delete;
+    Seqlock& operator=(const Seqlock&) = delete;
+
+    /// Replace the value. Only one thread may write
+    void write(const T& value);
+    /// Get a copy of the value as it was between two writes
+    T read() const;
+    /// Number of writes so far
+    std::uint64_t version() const
+    {
+        return _sequence.load(std::memory_order_acquire) / 2;
+    }
+
+  private:
+    static constexpr std::size_t WORDS = (sizeof(T) + 7) / 8;
+
+    /// Odd while a write is in progress
+    alignas(64) std::atomic<std::uint64_t> _sequence{0};
+    // The value is held as atomic words so that a reader racing a
+    // writer copies garbage it then throws away, rather than
+    // racing in the language's sense
+    std::atomic<std::uint64_t> _words[WORDS] = {};
+};
+
+template <typename T>
+Seqlock<T>::Seqlock(const T& value)
+{
+    std::uint64_t words[WORDS] = {};
+    std::memcpy(words, &value, sizeof(T));
+    for (std::size_t i = 0; i < WORDS; ++i) {
+        _words[i].store(words[i], std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+void Seqlock<T>::write(const T& value)
+{
+    std::uint64_t words[WORDS] = {};
+    std::memcpy(words, &value, sizeof(T));
+    std::uint64_t sequence = _sequence.load(std::memory_order_relaxed);
+    _sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < WORDS; ++i) {
+        _words[i].store(words[i], std::memory_order_relaxed);
+    }
+    _sequence.store(sequence + 2, std::memory_order_release);
+}
+
+template <typename T>
+T Seqlock<T>::read() const
+{
+    std::uint64_t words[WORDS];
+    while (true) {
+        std::uint64_t before = _sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        for (std::size_t i = 0; i < WORDS; ++i) {
+            words[i] = _words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_sequence.load(std::memory_order_relaxed) == before) {
+            break;
+        }
+    }
+    T value;
+    std::memcpy(&value, words, sizeof(T));
+    return value;
+}
@@ -0,0 +1,183 @@
+/**
+ * Self-contained simulations, and a runner that sweeps many of them
+ * across threads. A simulation owns everything it touches - its own
+ * order ids, random numbers, exchange and traders - so simulations
+ * can run side by side in one process
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "Exchange.h"
+#include "DealerTrader.h"
+#include "SpreadTrader.h"
+#include "PopulationTrader.h"
+
+/// The trader mix and settings for one simulation
+struct Scenario
+{
+    std::string name;
+    std::uint32_t seed = 1;
+    /// How many rounds to run for
+    round_t rounds = 1000;
+    /// Random limit order agents, and their settings
+    std::size_t randomTraders = 1000;
+    PopulationParameters randomParameters;
+    /// Random market order agents, and their settings
+    std::size_t marketTraders = 0;
+    PopulationParameters marketParameters;
+    /// Each dealer quotes around the middle of the market
+    std::size_t dealers = 2;
+    price_t dealerSpread = 2;
+    std::size_t spreadTraders = 1;
+};
+
+/// What happened in one simulation
+struct ScenarioResult
+{
+    std::string name;
+    /// Total quantity traded
+    unsigned long long volume = 0;
+    /// Number of executions
+    std::size_t trades = 0;
+    /// Price of the last trade at the end of each round, or 0
+    /// before the first trade
+    std::vector<price_t> pricePath;
+    /// PnL of every account, marked at the last trade price,
+    /// sorted from worst to best
+    std::vector<long long> pnl;
+
+    /// Get a PnL percentile, from 0 (worst) to 1 (best)
+    long long pnlPercentile(double percentile) const;
+    long long meanPnl() const;
+};
+
+class Simulation
+{
+  public:
+    explicit Simulation(const Scenario& scenario);
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    /// Run the scenario to the end
+    ScenarioResult run();
+
+  private:
+    Scenario _scenario;
+    /// Orders placed in this simulation take their ids from here
+    OrderIdSource _ids;
+    Exchange _exchange;
+    std::vector<std::unique_ptr<Trader>> _traders;
+
+    ScenarioResult _result;
+    price_t _lastPrice = 0;
+};
+
+/// Run every scenario, spread over `threads` threads
+/// @return the results, in the same order as the scenarios
+std::vector<ScenarioResult> runSweep(const std::vector<Scenario>& scenarios,
+                                     unsigned int threads = std::thread::hardware_concurrency());
+
+long long ScenarioResult::pnlPercentile(double percentile) const
+{
+    if (pnl.size() == 0) {
+        return 0;
+    }
+    std::size_t index = percentile * (pnl.size() - 1) + .5;
+    return pnl[std::min(index, pnl.size() - 1)];
+}
+
+long long ScenarioResult::meanPnl() const
+{
+    if (pnl.size() == 0) {
+        return 0;
+    }
+    long long total = 0;
+    for (long long value : pnl) {
+        total += value;
+    }
+    return total / static_cast<long long>(pnl.size());
+}
+
+Simulation::Simulation(const Scenario& scenario)
+  : _scenario(scenario), _exchange(scenario.seed)
+{
+    OrderIdSource::Scope scope(_ids);
+    price_t midpoint = (MARKET_MAX_PRICE - MARKET_MIN_PRICE) / 2;
+    for (std::size_t i = 0; i < scenario.dealers; ++i) {
+        _traders.emplace_back(new DealerTrader(_exchange, midpoint,
+                                               scenario.dealerSpread));
+    }
+    for (std::size_t i = 0; i < scenario.spreadTraders; ++i) {
+        _traders.emplace_back(new SpreadTrader(_exchange));
+    }
+    if (scenario.randomTraders) {
+        _traders.emplace_back(new PopulationTrader(_exchange,
+            PopulationTrader::Behaviour::RandomLimit,
+            scenario.randomTraders, scenario.randomParameters));
+    }
+    if (scenario.marketTraders) {
+        _traders.emplace_back(new PopulationTrader(_exchange,
+            PopulationTrader::Behaviour::RandomMarket,
+            scenario.marketTraders, scenario.marketParameters));
+    }
+    _result.name = scenario.name;
+    _exchange.addExecutionListener([this](const Execution& exec) {
+        _result.volume += exec.quantity;
+        ++_result.trades;
+        _lastPrice = exec.price;
+    });
+}
+
+ScenarioResult Simulation::run()
+{
+    OrderIdSource::Scope scope(_ids);
+    _result.pricePath.reserve(_scenario.rounds);
+    round_t round = _exchange.getRound();
+    while (round < _scenario.rounds) {
+        while (_exchange.getRound() == round) {
+            _exchange.tick();
+        }
+        round = _exchange.getRound();
+        // The round ends once the orders its traders sent are through
+        // the book, so the last round's are matched before marking
+        while (_exchange.getQueuedOrders()) {
+            _exchange.tick();
+        }
+        _result.pricePath.push_back(_lastPrice);
+    }
+    Ledger::Valuation valuation;
+    _exchange.getLedger().markToMarket(_lastPrice, valuation);
+    _result.pnl = valuation.pnl;
+    std::sort(_result.pnl.begin(), _result.pnl.end());
+    return _result;
+}
+
+std::vector<ScenarioResult> runSweep(const std::vector<Scenario>& scenarios,
+                                     unsigned int threads)
+{
+    std::vector<ScenarioResult> results(scenarios.size());
+    std::atomic<std::size_t> next(0);
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < scenarios.size(); i = next++) {
+            Simulation simulation(scenarios[i]);
+            results[i] = simulation.run();
+        }
+    };
+    threads = std::max(1u, std::min<unsigned int>(threads, scenarios.size()));
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    return results;
+}
@@ -4,21 +4,24 @@
 
 #pragma once
 
-#include "Trader.h"
+#include "CoroutineTrader.h"
 
-class SpreadTrader : public Trader
+class SpreadTrader : public CoroutineTrader
 {
   public:
     SpreadTrader(Exchange& exchange)
-      : Trader(exchange) {}
+      : CoroutineTrader(exchange) {}
 
-    void tick() final
+  private:
+    Strategy run() final
     {
-        const Book& book = _exchange.getBook();
-        if (book.hasBid() && book.hasOffer()) {
-            price_t bid = book.getBestBid();
-            price_t ask = book.getBestOffer();
-            price_t mid = (bid + ask) / 2;
+        auto hasMidpoint = [](const Book& book) {
+            return book.hasBid() && book.hasOffer();
+        };
+        while (true) {
+            co_await bookCondition(hasMidpoint);
+            const Book& book = _exchange.getBook();
+            price_t mid = (book.getBestBid() + book.getBestOffer()) / 2;
             // Buy at the midpoint, sell at midpoint + 1
             if (getFreeMoney() >= mid) {
                 submitOrder({Side::Buy, getFreeMoney()/mid, mid});
@@ -26,6 +29,13 @@ class SpreadTrader : public Trader
             if (getFreeShares() > 0) {
                 submitOrder({Side::Sell, getFreeShares(), mid + 1});
             }
+            // Wait for something new to quote: a new midpoint, or
+            // money or shares freed up by a fill
+            co_await bookCondition([&](const Book& book) {
+                return !hasMidpoint(book) ||
+                       (book.getBestBid() + book.getBestOffer()) / 2 != mid ||
+                       getFreeMoney() >= mid || getFreeShares() > 0;
+            });
         }
     }
-};
\ No newline at end of file
+};
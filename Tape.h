@@ -0,0 +1,344 @@
+/**
+ * The trade tape. Every execution is recorded as it happens, and
+ * running totals and OHLCV bars at several intervals are kept up to
+ * date trade by trade. The tape and the bars can also be written out
+ * as columns (see `Column.h`) for analysis outside the exchange
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <filesystem>
+
+#include "Column.h"
+#include "Exchange.h"
+
+/// Open, high, low, close and volume over a run of rounds
+struct Bar
+{
+    /// First round the bar covers
+    round_t start = 0;
+    price_t open = 0;
+    price_t high = 0;
+    price_t low = 0;
+    price_t close = 0;
+    unsigned long long volume = 0;
+    /// Sum of price times quantity, for the VWAP
+    unsigned long long notional = 0;
+    std::uint32_t trades = 0;
+
+    double vwap() const { return volume ? double(notional) / volume : 0; }
+};
+
+class Tape
+{
+  public:
+    /// @param intervals lengths of the bars to keep, in rounds
+    explicit Tape(std::vector<round_t> intervals = {1, 10, 100});
+    /// Record every execution on an exchange from now on, until the
+    /// tape is destroyed. The exchange must outlive the tape
+    explicit Tape(Exchange& exchange, std::vector<round_t> intervals = {1, 10, 100});
+    ~Tape();
+    Tape(const Tape&) = delete;
+    Tape& operator=(const Tape&) = delete;
+
+    /// Also write the tape and bars to columns in a directory, which
+    /// is created if needed. Columns already there are appended to.
+    /// Bars still open go in the columns once they close
+    /// @return if every column could be opened
+    bool open(const std::string& directory);
+    /// Write out trades and closed bars that haven't been yet
+    void flush();
+    /// Close the current bars, write everything out, and close the
+    /// columns. Later trades start new bars
+    /// @return if everything was written
+    bool close();
+
+    void record(round_t round, const Execution& exec);
+
+    unsigned long long getVolume() const { return _volume; }
+    unsigned long long getTrades() const { return _trades; }
+    price_t getLastPrice() const { return _lastPrice; }
+    /// Volume weighted average price of every trade so far
+    double getVwap() const { return _volume ? double(_notional) / _volume : 0; }
+
+    const std::vector<round_t>& getIntervals() const { return _intervals; }
+    /// Get the closed bars of an interval, oldest first. Rounds
+    /// without trades don't get a bar
+    const std::vector<Bar>& getBars(round_t interval) const;
+    /// Get the bar trades are currently going into, or null
+    const Bar* getCurrentBar(round_t interval) const;
+
+    /// Path of a tape column, with `field` one of `round`, `side`,
+    /// `quantity` or `price`
+    static std::string tapeColumn(const std::string& directory, const std::string& field);
+    /// Path of a bar column, with `field` one of `start`, `open`,
+    /// `high`, `low`, `close`, `volume`, `notional` or `trades`
+    static std::string barColumn(const std::string& directory, round_t interval,
+                                 const std::string& field);
+
+  private:
+    struct Series
+    {
+        round_t interval;
+        std::vector<Bar> bars;
+        Bar current;
+        bool hasCurrent = false;
+        /// Number of `bars` already written out
+        std::size_t written = 0;
+
+        ColumnWriter<round_t> start;
+        ColumnWriter<price_t> open, high, low, close;
+        ColumnWriter<unsigned long long> volume, notional;
+        ColumnWriter<std::uint32_t> trades;
+    };
+
+    /// Trades buffered before being written out
+    static constexpr std::size_t BUFFER_SIZE = 4096;
+
+    Series& getSeries(round_t interval) const;
+    void closeBar(Series& series);
+    /// Write everything out and close the columns, leaving bars open
+    /// @return if everything was written
+    bool closeColumns();
+
+    std::vector<round_t> _intervals;
+    std::vector<std::unique_ptr<Series>> _series;
+    /// The exchange being recorded, if any, and the tape's listener on it
+    Exchange* _exchange = nullptr;
+    listener_id_t _listener = 0;
+
+    unsigned long long _volume = 0;
+    unsigned long long _notional = 0;
+    unsigned long long _trades = 0;
+    price_t _lastPrice = 0;
+
+    bool _writing = false;
+    // Trades not written out yet, one array per column
+    std::vector<round_t> _rounds;
+    std::vector<std::uint8_t> _sides;
+    std::vector<quantity_t> _quantities;
+    std::vector<price_t> _prices;
+    ColumnWriter<round_t> _roundColumn;
+    ColumnWriter<std::uint8_t> _sideColumn;
+    ColumnWriter<quantity_t> _quantityColumn;
+    ColumnWriter<price_t> _priceColumn;
+};
+
+Tape::Tape(std::vector<round_t> intervals)
+  : _intervals(std::move(intervals))
+{
+    for (round_t interval : _intervals) {
+        assert(interval > 0);
+        _series.emplace_back(new Series);
+        _series.back()->interval = interval;
+    }
+}
+
+Tape::Tape(Exchange& exchange, std::vector<round_t> intervals)
+  : Tape(std::move(intervals))
+{
+    _exchange = &exchange;
+    _listener = exchange.addExecutionListener([this](const Execution& exec) {
+        record(_exchange->getRound(), exec);
+    });
+}
+
+Tape::~Tape()
+{
+    if (_exchange) {
+        _exchange->removeExecutionListener(_listener);
+    }
+    close();
+}
+
+std::string Tape::tapeColumn(const std::string& directory, const std::string& field)
+{
+    return (std::filesystem::path(directory) / ("tape." + field)).string();
+}
+
+std::string Tape::barColumn(const std::string& directory, round_t interval,
+                            const std::string& field)
+{
+    return (std::filesystem::path(directory) /
+            ("bars" + std::to_string(interval) + "." + field)).string();
+}
+
+bool Tape::open(const std::string& directory)
+{
+    closeColumns();
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    bool ok = !error;
+    ok &= _roundColumn.open(tapeColumn(directory, "round"));
+    ok &= _sideColumn.open(tapeColumn(directory, "side"));
+    ok &= _quantityColumn.open(tapeColumn(directory, "quantity"));
+    ok &= _priceColumn.open(tapeColumn(directory, "price"));
+    for (auto& series : _series) {
+        round_t interval = series->interval;
+        ok &= series->start.open(barColumn(directory, interval, "start"));
+        ok &= series->open.open(barColumn(directory, interval, "open"));
+        ok &= series->high.open(barColumn(directory, interval, "high"));
+        ok &= series->low.open(barColumn(directory, interval, "low"));
+        ok &= series->close.open(barColumn(directory, interval, "close"));
+        ok &= series->volume.open(barColumn(directory, interval, "volume"));
+        ok &= series->notional.open(barColumn(directory, interval, "notional"));
+        ok &= series->trades.open(barColumn(directory, interval, "trades"));
+        // Only bars closed from now on go in the columns
+        series->written = series->bars.size();
+    }
+    _writing = true;
+    return ok;
+}
+
+void Tape::record(round_t round, const Execution& exec)
+{
+    unsigned long long notional = static_cast<unsigned long long>(exec.price) * exec.quantity;
+    _volume += exec.quantity;
+    _notional += notional;
+    ++_trades;
+    _lastPrice = exec.price;
+
+    for (auto& seriesPtr : _series) {
+        Series& series = *seriesPtr;
+        round_t start = round - round % series.interval;
+        if (series.hasCurrent && series.current.start != start) {
+            closeBar(series);
+        }
+        Bar& bar = series.current;
+        if (!series.hasCurrent) {
+            series.hasCurrent = true;
+            bar = Bar();
+            bar.start = start;
+            bar.open = bar.high = bar.low = exec.price;
+        }
+        bar.high = std::max(bar.high, exec.price);
+        bar.low = std::min(bar.low, exec.price);
+        bar.close = exec.price;
+        bar.volume += exec.quantity;
+        bar.notional += notional;
+        ++bar.trades;
+    }
+
+    if (_writing) {
+        _rounds.push_back(round);
+        _sides.push_back(static_cast<std::uint8_t>(exec.side));
+        _quantities.push_back(exec.quantity);
+        _prices.push_back(exec.price);
+        if (_rounds.size() >= BUFFER_SIZE) {
+            flush();
+        }
+    }
+}
+
+void Tape::closeBar(Series& series)
+{
+    series.bars.push_back(series.current);
+    series.hasCurrent = false;
+}
+
+void Tape::flush()
+{
+    if (!_writing) {
+        return;
+    }
+    _roundColumn.append(_rounds);
+    _sideColumn.append(_sides);
+    _quantityColumn.append(_quantities);
+    _priceColumn.append(_prices);
+    _rounds.clear();
+    _sides.clear();
+    _quantities.clear();
+    _prices.clear();
+
+    for (auto& seriesPtr : _series) {
+        Series& series = *seriesPtr;
+        // Bars are few next to trades, so they are gathered
+        // into columns as they are written
+        std::size_t count = series.bars.size() - series.written;
+        if (count == 0) {
+            continue;
+        }
+        std::vector<round_t> start(count);
+        std::vector<price_t> open(count), high(count), low(count), close(count);
+        std::vector<unsigned long long> volume(count), notional(count);
+        std::vector<std::uint32_t> trades(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            const Bar& bar = series.bars[series.written + i];
+            start[i] = bar.start;
+            open[i] = bar.open;
+            high[i] = bar.high;
+            low[i] = bar.low;
+            close[i] = bar.close;
+            volume[i] = bar.volume;
+            notional[i] = bar.notional;
+            trades[i] = bar.trades;
+        }
+        series.start.append(start);
+        series.open.append(open);
+        series.high.append(high);
+        series.low.append(low);
+        series.close.append(close);
+        series.volume.append(volume);
+        series.notional.append(notional);
+        series.trades.append(trades);
+        series.written = series.bars.size();
+    }
+}
+
+bool Tape::close()
+{
+    for (auto& series : _series) {
+        if (series->hasCurrent) {
+            closeBar(*series);
+        }
+    }
+    return closeColumns();
+}
+
+bool Tape::closeColumns()
+{
+    if (!_writing) {
+        return true;
+    }
+    flush();
+    _writing = false;
+    bool ok = true;
+    ok &= _roundColumn.close();
+    ok &= _sideColumn.close();
+    ok &= _quantityColumn.close();
+    ok &= _priceColumn.close();
+    for (auto& series : _series) {
+        ok &= series->start.close();
+        ok &= series->open.close();
+        ok &= series->high.close();
+        ok &= series->low.close();
+        ok &= series->close.close();
+        ok &= series->volume.close();
+        ok &= series->notional.close();
+        ok &= series->trades.close();
+    }
+    return ok;
+}
+
+Tape::Series& Tape::getSeries(round_t interval) const
+{
+    auto itr = std::find(_intervals.begin(), _intervals.end(), interval);
+    assert(itr != _intervals.end());
+    return *_series[itr - _intervals.begin()];
+}
+
+const std::vector<Bar>& Tape::getBars(round_t interval) const
+{
+    return getSeries(interval).bars;
+}
+
+const Bar* Tape::getCurrentBar(round_t interval) const
+{
+    const Series& series = getSeries(interval);
+    return series.hasCurrent ? &series.current : nullptr;
+}
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+
 #include "Order.h"
 #include "Exchange.h"
 
@@ -19,14 +24,12 @@ class Trader
 {
 public:
     /// Create a new trader and add them to the exchange
-    Trader(Exchange& exchange)
-      : _exchange(exchange),
-        _money(TRADER_STARTING_CAPITAL), _shares(TRADER_STARTING_POSITION),
-        _moneyOutstanding(0), _sharesOutstanding(0)
-    {
-        _exchange.addTrader(this);
-    }
-    virtual ~Trader() {}
+    /// @param money, shares the balances the trader starts out with
+    Trader(Exchange& exchange, price_t money = TRADER_STARTING_CAPITAL,
+           quantity_t shares = TRADER_STARTING_POSITION)
+      : _exchange(exchange), _id(exchange.addTrader(this, money, shares)) {}
+    /// Destroying a trader disconnects it from the exchange
+    virtual ~Trader() { _exchange.removeTrader(*this); }
 
     /// Tick the trader. Logic about placing orders should
     /// generally occur here
@@ -36,64 +39,156 @@ public:
     /// has reached the market
     virtual void notifyOrderAccepted(Order ord);
     /// Notify the trader that an order they submitted has been
-    /// (perhaps partially) filled
+    /// (perhaps partially) filled. The exchange has already
+    /// settled the trade in the ledger
     virtual void notifyTraded(const Order& origOrder, quantity_t quantity, price_t price);
+    /// Notify the trader that an order they submitted has been
+    /// cancelled. `order` holds the quantity that was left unfilled,
+    /// which the exchange has already released in the ledger
+    virtual void notifyCancelled(const Order& order);
+    /// Notify the trader that the executions it was notified of have
+    /// all been settled, if it asked with `deferUntilSettled`
+    virtual void notifySettled();
+
+    /// Get the id the exchange knows the trader by
+    trader_id_t getId() const { return _id; }
 
     /// Get how much total money the trader has
-    price_t getMoney() const { return _money; }
+    price_t getMoney() const { return _exchange.getLedger().getMoney(_id); }
     /// Get how many total shares the trader owns
-    quantity_t getShares() const { return _shares; }
+    quantity_t getShares() const { return _exchange.getLedger().getShares(_id); }
     /// Get how much free money the trader has. This is the 
     /// total amount of money less the amount comitted to submitted
     /// orders, and represents the amount that can be used for new trades.
-    price_t getFreeMoney() const { return _money - _moneyOutstanding; }
+    price_t getFreeMoney() const
+    {
+        return getMoney() - _exchange.getLedger().getMoneyOutstanding(_id);
+    }
     /// Same thing as `getFreeMoney` but for shares
-    quantity_t getFreeShares() const { return _shares - _sharesOutstanding; }
+    quantity_t getFreeShares() const
+    {
+        return getShares() - _exchange.getLedger().getSharesOutstanding(_id);
+    }
 
 
 protected:
     /// Submit an order to the exchange.
     /// Subclasses should always call this to trade
     void submitOrder(Order order);
+    /// Submit an order for another of the trader's accounts
+    void submitOrder(Order order, trader_id_t account);
+    /// Cancel one of the trader's resting orders
+    /// @return if the order was succesfully cancelled
+    bool cancelOrder(order_id_t orderid);
+    /// Cancel all of the trader's resting orders
+    void cancelAllOrders();
+
+    /// Stop being ticked every round. The trader will then only be
+    /// ticked when one of the wakeups below comes due
+    void stopPolling();
+    /// Get ticked once, a number of rounds from now
+    void wakeAfter(round_t rounds);
+    /// Get ticked once, after the best bid or offer next changes
+    void wakeOnTopOfBookChange();
+    /// Get `notifySettled` once the executions being settled are
+    /// done. Acting on a fill from `notifyTraded` itself would see
+    /// the exchange partway through a batch of them
+    void deferUntilSettled();
+    /// Draw a random number from the exchange's generator
+    std::uint32_t random() { return _exchange.getRandom()(); }
+    /// Draw the number of rounds until the next event that
+    /// happens each round with probability `chance`
+    /// @return the number of rounds, or 0 if the event never happens
+    round_t randomArrival(double chance);
+    /// Get ticked once, at the next event that happens each round
+    /// with probability `chance`, rather than rolling for it every
+    /// round. Never ticks if the event never happens
+    void wakeAtNextArrival(double chance);
     Exchange& _exchange;
 
 private:
-    // Total amount of money the trader has
-    price_t _money;
-    // Total number of shares the trader has
-    quantity_t _shares;
-
-    // Amount of money currently locked for unfilled buy orders
-    price_t _moneyOutstanding;
-    // Number of shares currently locked for unfilled sell orders
-    quantity_t _sharesOutstanding;
+    // Index of the trader's balances in the exchange's ledger
+    trader_id_t _id;
 };
 
 void Trader::submitOrder(Order order)
 {
-    if (order.side == Side::Buy) {
-        assert(getFreeMoney() >= order.price * order.quantity);
-        _moneyOutstanding += order.price * order.quantity;
-    } else {
-        assert(getFreeShares() >= order.quantity);
-        _sharesOutstanding += order.quantity;
-    }
     _exchange.submitOrder(*this, order);
 }
 
-void Trader::tick() {}
+void Trader::submitOrder(Order order, trader_id_t account)
+{
+    _exchange.submitOrder(*this, order, account);
+}
 
-void Trader::notifyOrderAccepted(Order ord){}
+bool Trader::cancelOrder(order_id_t orderid)
+{
+    return _exchange.submitCancel(*this, orderid);
+}
+
+void Trader::cancelAllOrders()
+{
+    _exchange.submitCancelAll(*this);
+}
+
+void Trader::stopPolling()
+{
+    _exchange.setPolling(*this, false);
+}
 
-void Trader::notifyTraded(const Order& origOrder, quantity_t quantity, price_t price)
+void Trader::wakeAfter(round_t rounds)
 {
-    if (origOrder.side == Side::Buy) {
-        _money -= quantity * price;
-        _shares += quantity;
-        _moneyOutstanding -= origOrder.price * quantity;
-    } else {
-        _money += quantity * price;
-        _shares -= quantity;
-        _sharesOutstanding -= quantity;
+    // A wait past the last round must not wrap around to a near one
+    round_t now = _exchange.getRound();
+    rounds = std::min(rounds, std::numeric_limits<round_t>::max() - now);
+    _exchange.scheduleWakeup(*this, now + rounds);
+}
+
+void Trader::wakeOnTopOfBookChange()
+{
+    _exchange.subscribeTopOfBook(*this);
+}
+
+void Trader::deferUntilSettled()
+{
+    _exchange.deferUntilSettled(*this);
+}
+
+round_t Trader::randomArrival(double chance)
+{
+    if (chance <= 0) {
+        return 0;
     }
-}
\ No newline at end of file
+    if (chance >= 1) {
+        return 1;
+    }
+    // The wait for a per-round event is geometrically distributed,
+    // so it can be drawn directly instead of rolling every round
+    double u = (random() + 1.0) / 4294967297.0;
+    // log1p keeps tiny chances from rounding to a certain miss, and
+    // waits too long for a round_t are clamped rather than cast
+    double wait = std::log(u) / std::log1p(-chance);
+    constexpr round_t longest = std::numeric_limits<round_t>::max();
+    if (!(wait < static_cast<double>(longest - 1))) {
+        return longest;
+    }
+    return 1 + static_cast<round_t>(wait);
+}
+
+void Trader::wakeAtNextArrival(double chance)
+{
+    round_t wait = randomArrival(chance);
+    if (wait) {
+        wakeAfter(wait);
+    }
+}
+
+void Trader::tick() {}
+
+void Trader::notifyOrderAccepted(Order ord){}
+
+void Trader::notifyTraded(const Order& origOrder, quantity_t quantity, price_t price) {}
+
+void Trader::notifyCancelled(const Order& order) {}
+
+void Trader::notifySettled() {}
\ No newline at end of file
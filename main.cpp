@@ -1,4 +1,5 @@
 #include <iostream>
+#include <fstream>
 #include <cstdlib>
 #include <chrono>
 #include <thread>
@@ -11,6 +12,7 @@
 #include "RandomTrader.h"
 #include "DealerTrader.h"
 #include "SpreadTrader.h"
+#include "PopulationTrader.h"
 
 bool stop = false;
 
@@ -19,21 +21,22 @@ void signalHandler(int signal)
     stop = true;
 }
 
-int main()
+int main(int argc, char** argv)
 {
     signal(SIGINT, signalHandler);
 
-    srand(time(NULL));
-    Exchange exchange;
+    Exchange exchange(time(NULL));
+    // Given a file, write what each trader cost to it on the way out
+    const char* costsFile = argc > 1 ? argv[1] : nullptr;
+    exchange.setCostAccounting(costsFile != nullptr);
 
     SpreadTrader s1(exchange);
     DealerTrader d1(exchange);
     DealerTrader d2(exchange, (MARKET_MAX_PRICE - MARKET_MIN_PRICE) / 2, 1);
     constexpr int NUM_RANDOM_TRADERS = 1000;
-    RandomTrader* randomTraders[NUM_RANDOM_TRADERS];
-    for (int i = 0; i < NUM_RANDOM_TRADERS; ++i) {
-        randomTraders[i] = new RandomTrader(exchange);
-    }
+    PopulationTrader randomTraders(exchange,
+                                   PopulationTrader::Behaviour::RandomLimit,
+                                   NUM_RANDOM_TRADERS);
 
     Curses curses;
 
@@ -45,5 +48,9 @@ int main()
             std::chrono::milliseconds(25)
         );
     }
+    if (costsFile) {
+        std::ofstream costs(costsFile);
+        exchange.getCostAccounting().writeCsv(costs, exchange.getRound());
+    }
     return 0;
 }
\ No newline at end of file
@@ -1,13 +1,49 @@
 #define CATCH_CONFIG_MAIN
 
+#include <sstream>
+#include <filesystem>
+
 #include "catch.h"
 
 #include "Order.h"
 #include "Book.h"
 #include "Execution.h"
+#include "Ledger.h"
+#include "Scheduler.h"
 #include "Exchange.h"
 #include "Trader.h"
 #include "ManualTrader.h"
+#include "PopulationTrader.h"
+#include "CoroutineTrader.h"
+#include "SpreadTrader.h"
+#include "Simulation.h"
+#include "OrderFlow.h"
+#include "FlowTrader.h"
+#include "Tape.h"
+#include "MarketData.h"
+
+/// Trader that only counts how often it is ticked
+class WakeupTrader : public Trader
+{
+  public:
+    WakeupTrader(Exchange& exchange) : Trader(exchange) { stopPolling(); }
+    void tick() final { ++ticks; }
+    using Trader::wakeAfter;
+    using Trader::wakeOnTopOfBookChange;
+    int ticks = 0;
+};
+
+/// Trader that cancels an order as soon as any of it fills
+class CancelOnFillTrader : public ManualTrader
+{
+  public:
+    CancelOnFillTrader(Exchange& exchange) : ManualTrader(exchange) {}
+    void notifyTraded(const Order& origOrder, quantity_t quantity, price_t price) final
+    {
+        cancelled.push_back(cancelOrder(origOrder.id));
+    }
+    std::vector<bool> cancelled;
+};
 
 TEST_CASE("Order")
 {
@@ -25,6 +61,21 @@ TEST_CASE("Order")
         Order order2(Side::Sell, 3, 12);
         REQUIRE(order1.id != order2.id);
     }
+
+    SECTION("Order ID Source")
+    {
+        OrderIdSource source;
+        Order outside1(Side::Buy, 5, 100);
+        {
+            OrderIdSource::Scope scope(source);
+            Order inside1(Side::Buy, 5, 100);
+            Order inside2(Side::Buy, 5, 100);
+            REQUIRE(inside1.id == 0);
+            REQUIRE(inside2.id == 1);
+        }
+        Order outside2(Side::Buy, 5, 100);
+        REQUIRE(outside2.id == outside1.id + 1);
+    }
 }
 
 TEST_CASE("Execution")
@@ -139,7 +190,396 @@ TEST_CASE("Book")
         REQUIRE(orderBook.cancelOrder(o2.id) == false);
         REQUIRE(orderBook.cancelOrder(o3.id) == false);
         REQUIRE(orderBook.cancelOrder(o4.id) == true);
+        REQUIRE(orderBook.hasOffer() == false);
+    }
+
+    SECTION("Cancel All Orders")
+    {
+        Order o1({Side::Buy, 10, 10});
+        Order o2({Side::Buy, 5, 10});
+        Order o3({Side::Buy, 10, 9});
+        Order o4({Side::Sell, 10, 12});
+        Order o5({Side::Sell, 10, 13});
+        orderBook.addOrder(o1, 1);
+        orderBook.addOrder(o2, 2);
+        orderBook.addOrder(o3, 1);
+        orderBook.addOrder(o4, 1);
+        orderBook.addOrder(o5, 2);
+        // Partially fill one of trader 1's orders
+        orderBook.addOrder({Side::Buy, 4, 12});
+        auto cancelled = orderBook.cancelAllOrders(1);
+        REQUIRE(cancelled.size() == 3);
+        REQUIRE(std::find_if(cancelled.begin(), cancelled.end(),
+            [&](const Order& o){ return o.id == o4.id; })->quantity == 6);
+        REQUIRE(orderBook.getQuantityForLevel(10) == 5);
+        REQUIRE(orderBook.getQuantityForLevel(9) == 0);
+        REQUIRE(orderBook.getQuantityForLevel(12) == 0);
+        REQUIRE(orderBook.getQuantityForLevel(13) == 10);
+        REQUIRE(orderBook.getBestBid() == 10);
+        REQUIRE(orderBook.getBestOffer() == 13);
+        REQUIRE(orderBook.getOrder(o1.id) == nullptr);
+        REQUIRE(orderBook.getOrder(o2.id) != nullptr);
+        REQUIRE(orderBook.cancelAllOrders(1).size() == 0);
+        REQUIRE(orderBook.cancelOrder(o2.id) == true);
+        REQUIRE(orderBook.cancelAllOrders(2).size() == 1);
+        REQUIRE(orderBook.hasBid() == false);
+        REQUIRE(orderBook.hasOffer() == false);
+    }
+
+    SECTION("Auction")
+    {
+        orderBook.setMatching(Book::Matching::Auction);
+        Order a(Side::Buy, 10, 12);
+        Order b(Side::Buy, 10, 10);
+        Order c(Side::Sell, 5, 9);
+        Order d(Side::Sell, 10, 10);
+        Order e(Side::Sell, 10, 11);
+        for (const Order& order : {a, b, c, d, e}) {
+            REQUIRE(orderBook.addOrder(order).size() == 0);
+        }
+        REQUIRE(orderBook.getBestBid() == 12);
+        REQUIRE(orderBook.getBestOffer() == 9);
+        // Crossed, so a price can have both bids and offers
+        REQUIRE(orderBook.getQuantityForLevel(Side::Buy, 10) == 10);
+        REQUIRE(orderBook.getQuantityForLevel(Side::Sell, 10) == 10);
+        REQUIRE(orderBook.getQuantityForLevel(Side::Sell, 9) == 5);
+        REQUIRE(orderBook.getQuantityForLevel(Side::Buy, 9) == 0);
+
+        // 15 can trade at 10, more than at any other price
+        auto execs = orderBook.uncross();
+        REQUIRE(execs.size() == 3);
+        for (const auto& exec : execs) {
+            REQUIRE(exec.price == 10);
+        }
+        REQUIRE(execs[0].buyOrder.id == a.id);
+        REQUIRE(execs[0].sellOrder.id == c.id);
+        REQUIRE(execs[0].quantity == 5);
+        REQUIRE(execs[1].buyOrder.id == a.id);
+        REQUIRE(execs[1].sellOrder.id == d.id);
+        REQUIRE(execs[1].quantity == 5);
+        REQUIRE(execs[2].buyOrder.id == b.id);
+        REQUIRE(execs[2].sellOrder.id == d.id);
+        REQUIRE(execs[2].quantity == 5);
+        REQUIRE(execs[2].side == Side::Sell);
+
+        REQUIRE(orderBook.getBestBid() == 10);
+        REQUIRE(orderBook.getBestOffer() == 11);
+        REQUIRE(orderBook.getQuantityForLevel(10) == 5);
+        REQUIRE(orderBook.getOrder(a.id) == nullptr);
+        REQUIRE(orderBook.getOrder(b.id)->quantity == 5);
+        REQUIRE(orderBook.uncross().size() == 0);
+    }
+
+    SECTION("Auction Allocation")
+    {
+        orderBook.setMatching(Book::Matching::Auction);
+        Order a(Side::Buy, 6, 10);
+        Order b(Side::Buy, 2, 10);
+        orderBook.addOrder(a);
+        orderBook.addOrder(b);
+        orderBook.addOrder({Side::Sell, 4, 10});
+
+        SECTION("Time Priority")
+        {
+            auto execs = orderBook.uncross(Book::Allocation::TimePriority);
+            REQUIRE(execs.size() == 1);
+            REQUIRE(execs[0].buyOrder.id == a.id);
+            REQUIRE(execs[0].quantity == 4);
+            REQUIRE(orderBook.getOrder(a.id)->quantity == 2);
+            REQUIRE(orderBook.getOrder(b.id)->quantity == 2);
+        }
+
+        SECTION("Pro Rata")
+        {
+            auto execs = orderBook.uncross(Book::Allocation::ProRata);
+            REQUIRE(execs.size() == 2);
+            REQUIRE(orderBook.getOrder(a.id)->quantity == 3);
+            REQUIRE(orderBook.getOrder(b.id)->quantity == 1);
+            REQUIRE(orderBook.getQuantityForLevel(10) == 4);
+        }
+
+        SECTION("Pro Rata Remainder")
+        {
+            Order c(Side::Buy, 1, 10);
+            orderBook.addOrder(c);
+            orderBook.addOrder({Side::Sell, 1, 10});
+            // 5 of 9 at the level: shares of 3, 1 and 0 round down
+            // to 4, and the last unit goes to the oldest order
+            orderBook.uncross(Book::Allocation::ProRata);
+            REQUIRE(orderBook.getOrder(a.id)->quantity == 2);
+            REQUIRE(orderBook.getOrder(b.id)->quantity == 1);
+            REQUIRE(orderBook.getOrder(c.id)->quantity == 1);
+        }
+    }
+
+    SECTION("Iceberg Orders")
+    {
+        Order iceberg(Side::Sell, 30, 10);
+        iceberg.displayQuantity = 10;
+        Order plain(Side::Sell, 5, 10);
+        orderBook.addOrder(iceberg, 1);
+        orderBook.addOrder(plain, 2);
+        REQUIRE(orderBook.getQuantityForLevel(10) == 15);
+
+        // The shown part trades, then the iceberg goes behind the
+        // plain order with a fresh slice shown
+        auto execs = orderBook.addOrder({Side::Buy, 12, 10});
+        REQUIRE(execs.size() == 2);
+        REQUIRE(execs[0].quantity == 10);
+        REQUIRE(execs[0].sellOrder.id == iceberg.id);
+        REQUIRE(execs[0].sellOrder.quantity == 30);
+        REQUIRE(execs[1].quantity == 2);
+        REQUIRE(execs[1].sellOrder.id == plain.id);
+        REQUIRE(orderBook.getQuantityForLevel(10) == 13);
+        REQUIRE(orderBook.getOrder(iceberg.id)->quantity == 20);
+
+        execs = orderBook.addOrder({Side::Buy, 20, 10});
+        REQUIRE(execs.size() == 3);
+        REQUIRE(execs[2].quantity == 7);
+        REQUIRE(orderBook.getQuantityForLevel(10) == 3);
+        REQUIRE(orderBook.getOrder(iceberg.id)->quantity == 3);
+
+        REQUIRE(orderBook.cancelAllOrders(1).size() == 1);
+        REQUIRE_FALSE(orderBook.hasOffer());
+
+        SECTION("In Auctions")
+        {
+            orderBook.setMatching(Book::Matching::Auction);
+            Order auctionIceberg(Side::Sell, 30, 10);
+            auctionIceberg.displayQuantity = 5;
+            orderBook.addOrder(auctionIceberg);
+            orderBook.addOrder({Side::Buy, 20, 10});
+            // Hidden quantity takes part in the auction
+            execs = orderBook.uncross();
+            REQUIRE(execs.size() == 1);
+            REQUIRE(execs[0].quantity == 20);
+            REQUIRE(orderBook.getOrder(auctionIceberg.id)->quantity == 10);
+            REQUIRE(orderBook.getQuantityForLevel(10) == 5);
+            REQUIRE_FALSE(orderBook.hasBid());
+        }
+    }
+
+    SECTION("Stop Orders")
+    {
+        Order stop(Side::Buy, 5, 12);
+        stop.stopPrice = 11;
+        REQUIRE(orderBook.addOrder(stop, 1).size() == 0);
+        REQUIRE(orderBook.getOrder(stop.id) != nullptr);
+        REQUIRE_FALSE(orderBook.hasBid());
+
+        orderBook.addOrder({Side::Sell, 5, 10});
+        orderBook.addOrder({Side::Sell, 1, 11});
+        orderBook.addOrder({Side::Sell, 5, 12});
+        REQUIRE(orderBook.addOrder({Side::Buy, 5, 10}).size() == 1);
+        REQUIRE(orderBook.getLastPrice() == 10);
+        REQUIRE(orderBook.getOrder(stop.id) != nullptr);
+
+        // A trade at the stop price triggers it
+        auto execs = orderBook.addOrder({Side::Buy, 1, 11});
+        REQUIRE(execs.size() == 2);
+        REQUIRE(execs[1].buyOrder.id == stop.id);
+        REQUIRE(execs[1].quantity == 5);
+        REQUIRE(orderBook.getOrder(stop.id) == nullptr);
+        REQUIRE_FALSE(orderBook.hasOffer());
+
+        SECTION("Cascade")
+        {
+            orderBook.addOrder({Side::Buy, 5, 9});
+            orderBook.addOrder({Side::Buy, 5, 8});
+            orderBook.addOrder({Side::Buy, 5, 4});
+            Order first(Side::Sell, 5, 1);
+            first.stopPrice = 9;
+            Order second(Side::Sell, 5, 1);
+            second.stopPrice = 7;
+            orderBook.addOrder(first);
+            orderBook.addOrder(second);
+            // Each stop's trades push the price down to the next
+            execs = orderBook.addOrder({Side::Sell, 1, 9});
+            REQUIRE(execs.size() == 5);
+            REQUIRE(execs[1].sellOrder.id == first.id);
+            REQUIRE(execs[3].sellOrder.id == second.id);
+            REQUIRE(orderBook.getOrder(first.id) == nullptr);
+            REQUIRE(orderBook.getOrder(second.id) == nullptr);
+            REQUIRE(orderBook.getBestBid() == 4);
+            REQUIRE(orderBook.getQuantityForLevel(4) == 4);
+
+            // Stops already past the last trade trigger straight away
+            Order late(Side::Sell, 1, 4);
+            late.stopPrice = orderBook.getLastPrice() + 1;
+            REQUIRE(orderBook.addOrder(late).size() == 1);
+        }
+
+        SECTION("Mid-Sweep")
+        {
+            Book book;
+            book.addOrder({Side::Sell, 1, 12});
+            book.addOrder({Side::Buy, 1, 12});
+            REQUIRE(book.getLastPrice() == 12);
+            Order sellStop(Side::Sell, 1, 5);
+            sellStop.stopPrice = 10;
+            REQUIRE(book.addOrder(sellStop).size() == 0);
+            book.addOrder({Side::Sell, 1, 8});
+            book.addOrder({Side::Sell, 1, 12});
+            book.addOrder({Side::Buy, 1, 5});
+            // The sweep prints at 10, triggering the stop, then at 12
+            execs = book.addOrder({Side::Buy, 2, 12});
+            REQUIRE(execs.size() == 3);
+            REQUIRE(execs[0].price == 10);
+            REQUIRE(execs[1].price == 12);
+            REQUIRE(execs[2].sellOrder.id == sellStop.id);
+            REQUIRE(book.getOrder(sellStop.id) == nullptr);
+            REQUIRE_FALSE(book.hasBid());
+        }
+
+        SECTION("Cancel")
+        {
+            Order sellStop(Side::Sell, 5, 5);
+            sellStop.stopPrice = 5;
+            orderBook.addOrder(sellStop, 1);
+            Order otherStop(Side::Sell, 5, 5);
+            otherStop.stopPrice = 6;
+            orderBook.addOrder(otherStop, 1);
+            REQUIRE(orderBook.cancelOrder(sellStop.id));
+            REQUIRE_FALSE(orderBook.cancelOrder(sellStop.id));
+            auto cancelled = orderBook.cancelAllOrders(1);
+            REQUIRE(cancelled.size() == 1);
+            REQUIRE(cancelled[0].id == otherStop.id);
+            REQUIRE(orderBook.getOrder(otherStop.id) == nullptr);
+        }
+    }
+}
+
+TEST_CASE("Ledger")
+{
+    Ledger ledger;
+    trader_id_t a = ledger.addAccount(1000, 100);
+    trader_id_t b = ledger.addAccount(500, 0);
+    REQUIRE(a == 0);
+    REQUIRE(b == 1);
+
+    SECTION("Settlement")
+    {
+        Order buyOrder(Side::Buy, 10, 8);
+        Order sellOrder(Side::Sell, 10, 2);
+        ledger.lockForOrder(b, buyOrder);
+        ledger.lockForOrder(a, sellOrder);
+        REQUIRE(ledger.getMoneyOutstanding(b) == 80);
+        REQUIRE(ledger.getSharesOutstanding(a) == 10);
+        ledger.settleTrade(b, buyOrder, 4, 5);
+        ledger.settleTrade(a, sellOrder, 4, 5);
+        REQUIRE(ledger.getMoney(b) == 480);
+        REQUIRE(ledger.getShares(b) == 4);
+        REQUIRE(ledger.getMoneyOutstanding(b) == 48);
+        REQUIRE(ledger.getMoney(a) == 1020);
+        REQUIRE(ledger.getShares(a) == 96);
+        REQUIRE(ledger.getSharesOutstanding(a) == 6);
+        buyOrder.quantity = 6;
+        ledger.releaseForOrder(b, buyOrder);
+        REQUIRE(ledger.getMoneyOutstanding(b) == 0);
+    }
+
+    SECTION("Mark to Market")
+    {
+        Order buyOrder(Side::Buy, 10, 5);
+        Order sellOrder(Side::Sell, 10, 5);
+        ledger.lockForOrder(b, buyOrder);
+        ledger.lockForOrder(a, sellOrder);
+        ledger.settleTrade(b, buyOrder, 10, 5);
+        ledger.settleTrade(a, sellOrder, 10, 5);
+        Ledger::Valuation valuation;
+        ledger.markToMarket(7, valuation);
+        REQUIRE(valuation.values.size() == 2);
+        REQUIRE(valuation.values[a] == 1050 + 90 * 7);
+        REQUIRE(valuation.values[b] == 450 + 10 * 7);
+        REQUIRE(valuation.pnl[a] == -20);
+        REQUIRE(valuation.pnl[b] == 20);
+        REQUIRE(valuation.exposure == 100 * 7);
+    }
+}
+
+/// Trader that does nothing, with a comma in its class name
+template<typename A, typename B>
+class PairedTrader : public Trader
+{
+  public:
+    PairedTrader(Exchange& exchange) : Trader(exchange) {}
+};
+
+/// Strategy that buys, waits for a fill, rests, then cancels
+class ScriptedTrader : public CoroutineTrader
+{
+  public:
+    ScriptedTrader(Exchange& exchange) : CoroutineTrader(exchange) {}
+    std::vector<std::string> log;
+    std::vector<Fill> fills;
+
+  private:
+    Strategy run() final
+    {
+        log.push_back("start");
+        Order buyOrder(Side::Buy, 10, 5);
+        submitOrder(buyOrder);
+        fills.push_back(co_await nextFill());
+        log.push_back("filled");
+        co_await sleep(2);
+        log.push_back("slept");
+        co_await bookCondition([](const Book& book) {
+            return book.hasOffer() && book.getBestOffer() <= 6;
+        });
+        log.push_back("offered");
+        bool cancelled = co_await cancel(buyOrder.id);
+        log.push_back(cancelled ? "cancelled" : "not cancelled");
+    }
+};
+
+/// Strategy that sweeps the offers and cancels what's left of its
+/// order on the first fill
+class SweepTrader : public CoroutineTrader
+{
+  public:
+    SweepTrader(Exchange& exchange, std::vector<std::string>& log)
+      : CoroutineTrader(exchange), log(log) {}
+    std::vector<std::string>& log;
+    std::vector<Fill> fills;
+
+  private:
+    Strategy run() final
+    {
+        Order buyOrder(Side::Buy, 10, 12);
+        submitOrder(buyOrder);
+        fills.push_back(co_await nextFill());
+        log.push_back("filled");
+        bool cancelled = co_await cancel(buyOrder.id);
+        log.push_back(cancelled ? "cancelled" : "not cancelled");
+        fills.push_back(co_await nextFill());
     }
+};
+
+TEST_CASE("Scheduler")
+{
+    Scheduler scheduler(4);
+    std::vector<trader_id_t> due;
+    scheduler.schedule(1, 2);
+    scheduler.schedule(2, 6); // same slot as round 2
+    scheduler.schedule(3, 2);
+    REQUIRE(scheduler.size() == 3);
+    scheduler.popDue(1, due);
+    REQUIRE(due.size() == 0);
+    scheduler.popDue(2, due);
+    std::sort(due.begin(), due.end());
+    REQUIRE(due == std::vector<trader_id_t>{1, 3});
+    REQUIRE(scheduler.size() == 1);
+    due.clear();
+    // Rounds in the past are moved to the next round
+    scheduler.schedule(4, 1);
+    scheduler.popDue(3, due);
+    REQUIRE(due == std::vector<trader_id_t>{4});
+    due.clear();
+    for (round_t round = 4; round <= 6; ++round) {
+        scheduler.popDue(round, due);
+    }
+    REQUIRE(due == std::vector<trader_id_t>{2});
+    REQUIRE(scheduler.size() == 0);
 }
 
 TEST_CASE("Exchange")
@@ -192,4 +632,973 @@ TEST_CASE("Exchange")
         REQUIRE(trader1.getFreeShares() == trader1.getShares());
         REQUIRE(trader2.getFreeShares() == trader2.getShares() - 10);
     }
+
+    SECTION("Iceberg Orders")
+    {
+        Order iceberg(Side::Sell, 30, 5);
+        iceberg.displayQuantity = 10;
+        trader2.penOrder(iceberg);
+        trader1.penOrder({Side::Buy, 15, 5});
+        exchange.tick();
+        exchange.tick();
+        exchange.tick();
+        // The iceberg arrives second, trades its whole quantity
+        // against the bid and shows a fresh slice of what's left
+        REQUIRE(exchange.getBook().getQuantityForLevel(5) == 10);
+        REQUIRE(trader1.getShares() == TRADER_STARTING_POSITION + 15);
+        REQUIRE(trader2.getMoney() == TRADER_STARTING_CAPITAL + 15 * 5);
+        REQUIRE(trader2.getShares() == TRADER_STARTING_POSITION - 15);
+        // The hidden part stays locked
+        REQUIRE(trader2.getFreeShares() == TRADER_STARTING_POSITION - 30);
+    }
+
+    SECTION("Cancel")
+    {
+        Order buyOrder(Side::Buy, 10, 8);
+        trader1.penOrder(buyOrder);
+        trader1.penOrder({Side::Buy, 10, 9});
+        trader2.penOrder({Side::Sell, 20, 15});
+        exchange.tick();
+        exchange.tick();
+        exchange.tick();
+        exchange.tick();
+        REQUIRE(trader1.getFreeMoney() == TRADER_STARTING_CAPITAL - 170);
+        REQUIRE(exchange.submitCancel(trader2, buyOrder.id) == false);
+        REQUIRE(exchange.submitCancel(trader1, buyOrder.id) == true);
+        REQUIRE(exchange.submitCancel(trader1, buyOrder.id) == false);
+        REQUIRE(trader1.getFreeMoney() == TRADER_STARTING_CAPITAL - 90);
+        REQUIRE(exchange.submitCancelAll(trader1) == 1);
+        REQUIRE(trader1.getFreeMoney() == TRADER_STARTING_CAPITAL);
+        REQUIRE(exchange.getBook().hasBid() == false);
+        REQUIRE(exchange.submitCancelAll(trader2) == 1);
+        REQUIRE(trader2.getFreeShares() == TRADER_STARTING_POSITION);
+        REQUIRE(exchange.getBook().hasOffer() == false);
+    }
+
+    SECTION("Cancel While Notified")
+    {
+        trader2.penOrder({Side::Sell, 3, 10});
+        trader2.penOrder({Side::Sell, 3, 11});
+        CancelOnFillTrader buyer(exchange);
+        buyer.penOrder({Side::Buy, 10, 12});
+        for (int i = 0; i < 4; ++i) {
+            exchange.tick();
+        }
+        // Both fills are settled before the buyer hears of the first,
+        // so the cancel only takes what is left on the book
+        REQUIRE(buyer.cancelled == std::vector<bool>{true, false});
+        REQUIRE(buyer.getShares() == TRADER_STARTING_POSITION + 6);
+        // Trades are at the midpoint of the two orders' prices
+        REQUIRE(buyer.getMoney() == TRADER_STARTING_CAPITAL - 6 * 11);
+        REQUIRE(buyer.getFreeMoney() == buyer.getMoney());
+        REQUIRE(trader2.getMoney() == TRADER_STARTING_CAPITAL + 6 * 11);
+        REQUIRE(trader1.getMoney() == TRADER_STARTING_CAPITAL);
+        REQUIRE(trader1.getFreeMoney() == TRADER_STARTING_CAPITAL);
+        REQUIRE(exchange.getBook().hasBid() == false);
+    }
+
+    SECTION("Disconnect")
+    {
+        trader_id_t account;
+        {
+            ManualTrader trader3(exchange);
+            account = trader3.getId();
+            trader3.penOrder({Side::Sell, 10, 15});
+            exchange.tick();
+            exchange.tick();
+            REQUIRE(exchange.getBook().hasOffer() == true);
+            trader3.penOrder({Side::Buy, 10, 5});
+            exchange.tick(); // the buy is queued, but not on the book
+        }
+        REQUIRE(exchange.getBook().hasOffer() == false);
+        // Queued orders are only dropped when they come up
+        REQUIRE(exchange.getLedger().getMoneyOutstanding(account) == 50);
+        exchange.tick(); // the disconnected trader is no longer ticked
+        REQUIRE(exchange.getLedger().getMoneyOutstanding(account) == 0);
+        REQUIRE(exchange.getBook().hasBid() == false);
+    }
+
+    SECTION("Scheduled Wakeups")
+    {
+        WakeupTrader sleeper(exchange);
+        exchange.tick();
+        REQUIRE(sleeper.ticks == 0);
+        sleeper.wakeAfter(3);
+        sleeper.wakeAfter(3);
+        exchange.tick();
+        exchange.tick();
+        REQUIRE(sleeper.ticks == 0);
+        exchange.tick();
+        REQUIRE(sleeper.ticks == 1);
+        exchange.tick();
+        REQUIRE(sleeper.ticks == 1);
+
+        sleeper.wakeOnTopOfBookChange();
+        exchange.tick();
+        REQUIRE(sleeper.ticks == 1);
+        trader1.penOrder({Side::Buy, 10, 5});
+        exchange.tick(); // push the order into the queue
+        exchange.tick(); // the order moves the best bid
+        exchange.tick();
+        REQUIRE(sleeper.ticks == 2);
+        trader1.penOrder({Side::Buy, 10, 4});
+        exchange.tick();
+        exchange.tick(); // the best bid does not move
+        exchange.tick();
+        REQUIRE(sleeper.ticks == 2);
+    }
+
+    SECTION("Auction")
+    {
+        exchange.setAuctionInterval(3);
+        trader1.penOrder({Side::Buy, 10, 10});
+        trader2.penOrder({Side::Sell, 10, 8});
+        exchange.tick(); // round 1
+        exchange.tick();
+        exchange.tick();
+        // Both orders rest on a crossed book
+        REQUIRE(exchange.getBook().getBestBid() == 10);
+        REQUIRE(exchange.getBook().getBestOffer() == 8);
+        REQUIRE(trader1.getShares() == TRADER_STARTING_POSITION);
+        exchange.tick(); // round 2
+        REQUIRE(trader1.getShares() == TRADER_STARTING_POSITION);
+        exchange.tick(); // round 3 starts with an auction
+        REQUIRE(trader1.getShares() == TRADER_STARTING_POSITION + 10);
+        REQUIRE(trader2.getShares() == TRADER_STARTING_POSITION - 10);
+        REQUIRE(trader1.getMoney() == TRADER_STARTING_CAPITAL - 80);
+        REQUIRE(trader2.getMoney() == TRADER_STARTING_CAPITAL + 80);
+        REQUIRE(trader1.getFreeMoney() == trader1.getMoney());
+        REQUIRE(exchange.getBook().hasBid() == false);
+
+        trader1.penOrder({Side::Buy, 5, 10});
+        trader2.penOrder({Side::Sell, 5, 9});
+        exchange.tick();
+        exchange.tick();
+        exchange.tick();
+        exchange.setAuctionInterval(0);
+        REQUIRE(trader1.getShares() == TRADER_STARTING_POSITION + 15);
+        REQUIRE(exchange.getBook().getMatching() == Book::Matching::Continuous);
+    }
+
+    SECTION("Listener Removes Itself")
+    {
+        int firstCalls = 0;
+        int secondCalls = 0;
+        listener_id_t first = 0;
+        first = exchange.addExecutionListener([&](const Execution&) {
+            ++firstCalls;
+            exchange.removeExecutionListener(first);
+        });
+        exchange.addExecutionListener([&](const Execution&) {
+            ++secondCalls;
+        });
+        trader1.penOrder({Side::Buy, 2, 10});
+        trader2.penOrder({Side::Sell, 1, 10});
+        trader2.penOrder({Side::Sell, 1, 10});
+        for (int i = 0; i < 5; ++i) {
+            exchange.tick();
+        }
+        // The listener after it still hears of the execution
+        REQUIRE(firstCalls == 1);
+        REQUIRE(secondCalls == 2);
+    }
+
+    SECTION("Stop Triggered By Last Auction")
+    {
+        trader1.penOrder({Side::Buy, 1, 12});
+        trader2.penOrder({Side::Sell, 1, 12});
+        exchange.tick();
+        exchange.tick();
+        exchange.tick();
+        REQUIRE(exchange.getBook().getLastPrice() == 12);
+
+        exchange.setAuctionInterval(100);
+        Order stop(Side::Sell, 5, 5);
+        stop.stopPrice = 10;
+        trader2.penOrder(stop);
+        trader2.penOrder({Side::Sell, 1, 10});
+        trader1.penOrder({Side::Buy, 6, 10});
+        exchange.tick();
+        exchange.tick();
+        exchange.tick();
+        exchange.tick();
+        REQUIRE(exchange.getBook().getBestBid() == 10);
+        REQUIRE(exchange.getBook().getBestOffer() == 10);
+
+        // The stop the last auction triggers matches as it is placed,
+        // rather than leaving the book crossed
+        exchange.setAuctionInterval(0);
+        REQUIRE(exchange.getBook().hasBid() == false);
+        REQUIRE(exchange.getBook().hasOffer() == false);
+        REQUIRE(exchange.getBook().getOrder(stop.id) == nullptr);
+        REQUIRE(trader1.getShares() == TRADER_STARTING_POSITION + 7);
+        REQUIRE(trader2.getShares() == TRADER_STARTING_POSITION - 7);
+        // The stop trades halfway between its limit and the bid
+        REQUIRE(trader1.getMoney() == TRADER_STARTING_CAPITAL - 12 - 10 - 5 * 7);
+    }
+}
+
+TEST_CASE("BatchRandom")
+{
+    BatchRandom random1(64, 7);
+    BatchRandom random2(64, 7);
+    BatchRandom random3(64, 8);
+    std::vector<std::uint32_t> out1(64), out2(64), out3(64);
+    random1.next(out1.data());
+    random2.next(out2.data());
+    random3.next(out3.data());
+    REQUIRE(out1 == out2);
+    REQUIRE(out1 != out3);
+    std::sort(out1.begin(), out1.end());
+    REQUIRE(std::unique(out1.begin(), out1.end()) == out1.end());
+}
+
+TEST_CASE("PopulationTrader")
+{
+    Exchange exchange;
+    constexpr std::size_t AGENTS = 200;
+
+    auto requireBalancesConserved = [&]() {
+        const Ledger& ledger = exchange.getLedger();
+        price_t money = 0;
+        quantity_t shares = 0;
+        for (trader_id_t account = 0; account < ledger.size(); ++account) {
+            REQUIRE(ledger.getMoneyOutstanding(account) <= ledger.getMoney(account));
+            REQUIRE(ledger.getSharesOutstanding(account) <= ledger.getShares(account));
+            money += ledger.getMoney(account);
+            shares += ledger.getShares(account);
+        }
+        REQUIRE(money == ledger.size() * TRADER_STARTING_CAPITAL);
+        REQUIRE(shares == ledger.size() * TRADER_STARTING_POSITION);
+    };
+
+    SECTION("Accounts")
+    {
+        ManualTrader before(exchange);
+        PopulationTrader population(exchange,
+            PopulationTrader::Behaviour::RandomLimit, AGENTS);
+        ManualTrader after(exchange);
+        REQUIRE(population.size() == AGENTS);
+        REQUIRE(population.getAccount(0) == population.getId());
+        REQUIRE(after.getId() == population.getAccount(AGENTS - 1) + 1);
+        REQUIRE(exchange.getLedger().size() == AGENTS + 2);
+    }
+
+    SECTION("Random Limit")
+    {
+        PopulationParameters parameters;
+        parameters.tradeChance = .5;
+        PopulationTrader population(exchange,
+            PopulationTrader::Behaviour::RandomLimit, AGENTS, parameters);
+        for (int i = 0; i < 5000; ++i) {
+            exchange.tick();
+        }
+        REQUIRE(exchange.getRound() > 1);
+        REQUIRE(exchange.getBook().hasBid());
+        REQUIRE(exchange.getBook().hasOffer());
+        requireBalancesConserved();
+    }
+
+    SECTION("Random Market Against Dealers")
+    {
+        PopulationTrader dealers(exchange,
+            PopulationTrader::Behaviour::Dealer, 10);
+        PopulationTrader takers(exchange,
+            PopulationTrader::Behaviour::RandomMarket, AGENTS);
+        exchange.tick(); // dealers quote, takers maybe trade
+        for (std::size_t agent = 0; agent < dealers.size(); ++agent) {
+            trader_id_t account = dealers.getAccount(agent);
+            REQUIRE(exchange.getLedger().getSharesOutstanding(account) ==
+                    TRADER_STARTING_POSITION);
+        }
+        for (int i = 0; i < 5000; ++i) {
+            exchange.tick();
+        }
+        requireBalancesConserved();
+    }
+
+    SECTION("Disconnect")
+    {
+        {
+            PopulationTrader population(exchange,
+                PopulationTrader::Behaviour::Dealer, AGENTS);
+            exchange.tick();
+            exchange.tick();
+            REQUIRE(exchange.getBook().hasBid());
+        }
+        REQUIRE(exchange.getBook().hasBid() == false);
+        REQUIRE(exchange.getBook().hasOffer() == false);
+    }
+}
+
+TEST_CASE("CoroutineTrader")
+{
+    Exchange exchange;
+    ManualTrader counterparty(exchange);
+
+    SECTION("Scripted Strategy")
+    {
+        ScriptedTrader trader(exchange);
+        REQUIRE(trader.log.empty());
+        exchange.tick(); // the strategy starts and submits its order
+        REQUIRE(trader.log == std::vector<std::string>{"start"});
+        exchange.tick(); // the order reaches the book
+        REQUIRE(exchange.getBook().getBestBid() == 5);
+        for (int i = 0; i < 5; ++i) {
+            exchange.tick();
+        }
+        REQUIRE(trader.log.size() == 1);
+
+        counterparty.penOrder({Side::Sell, 4, 5});
+        exchange.tick();
+        exchange.tick(); // the sell partially fills the buy
+        REQUIRE(trader.log.back() == "filled");
+        REQUIRE(trader.fills.size() == 1);
+        REQUIRE(trader.fills[0].quantity == 4);
+        REQUIRE(trader.fills[0].price == 5);
+
+        round_t filledRound = exchange.getRound();
+        while (trader.log.back() == "filled") {
+            exchange.tick();
+        }
+        REQUIRE(trader.log.back() == "slept");
+        REQUIRE(exchange.getRound() == filledRound + 2);
+
+        counterparty.penOrder({Side::Sell, 10, 8});
+        exchange.tick();
+        exchange.tick();
+        exchange.tick();
+        REQUIRE(trader.log.back() == "slept");
+        counterparty.penOrder({Side::Sell, 10, 6});
+        exchange.tick();
+        exchange.tick(); // the offer moves to 6
+        exchange.tick();
+        REQUIRE(trader.log == std::vector<std::string>{
+            "start", "filled", "slept", "offered", "cancelled"});
+        REQUIRE(exchange.getBook().hasBid() == false);
+        REQUIRE(trader.getFreeMoney() == trader.getMoney());
+    }
+
+    SECTION("Cancel After Partial Fill")
+    {
+        std::vector<std::string> log;
+        exchange.addExecutionListener([&log](const Execution&) {
+            log.push_back("execution");
+        });
+        counterparty.penOrder({Side::Sell, 3, 10});
+        counterparty.penOrder({Side::Sell, 3, 11});
+        SweepTrader trader(exchange, log);
+        for (int i = 0; i < 4; ++i) {
+            exchange.tick();
+        }
+        // The strategy only resumes once the whole sweep is settled,
+        // and then cancels just what is left
+        REQUIRE(log == std::vector<std::string>{
+            "execution", "execution", "filled", "cancelled"});
+        REQUIRE(trader.fills.size() == 2);
+        REQUIRE(trader.fills[0].order.quantity == 10);
+        REQUIRE(trader.fills[1].order.quantity == 7);
+        REQUIRE(trader.getShares() == TRADER_STARTING_POSITION + 6);
+        REQUIRE(trader.getFreeMoney() == trader.getMoney());
+        REQUIRE(exchange.getBook().hasBid() == false);
+    }
+
+    SECTION("Spread Trader")
+    {
+        SpreadTrader spread(exchange);
+        for (int i = 0; i < 5; ++i) {
+            exchange.tick();
+        }
+        REQUIRE(spread.getFreeMoney() == TRADER_STARTING_CAPITAL);
+        counterparty.penOrder({Side::Buy, 1, 8});
+        counterparty.penOrder({Side::Sell, 1, 12});
+        for (int i = 0; i < 8; ++i) {
+            exchange.tick();
+        }
+        // Quotes around the midpoint of 10
+        REQUIRE(exchange.getBook().getBestBid() == 10);
+        REQUIRE(exchange.getBook().getBestOffer() == 11);
+        REQUIRE(exchange.getBook().getQuantityForLevel(10) ==
+                TRADER_STARTING_CAPITAL / 10);
+        REQUIRE(exchange.getBook().getQuantityForLevel(11) ==
+                TRADER_STARTING_POSITION);
+    }
+}
+
+TEST_CASE("Simulation")
+{
+    Scenario scenario;
+    scenario.rounds = 200;
+    scenario.randomTraders = 100;
+    scenario.marketTraders = 20;
+    scenario.marketParameters.maxQuantity = 2;
+
+    SECTION("Repeatable")
+    {
+        ScenarioResult first = Simulation(scenario).run();
+        ScenarioResult second = Simulation(scenario).run();
+        REQUIRE(first.trades > 0);
+        REQUIRE(first.volume == second.volume);
+        REQUIRE(first.pricePath == second.pricePath);
+        REQUIRE(first.pnl == second.pnl);
+        REQUIRE(first.pricePath.size() == scenario.rounds);
+        REQUIRE(first.pricePath.back() != 0);
+        REQUIRE(first.pnl.size() == 2 + 1 + 100 + 20);
+        REQUIRE(std::is_sorted(first.pnl.begin(), first.pnl.end()));
+        REQUIRE(first.pnlPercentile(0) == first.pnl.front());
+        REQUIRE(first.pnlPercentile(1) == first.pnl.back());
+        REQUIRE(first.meanPnl() >= first.pnl.front());
+        REQUIRE(first.meanPnl() <= first.pnl.back());
+    }
+
+    SECTION("Price Path")
+    {
+        scenario.rounds = 3;
+        scenario.randomParameters.tradeChance = 1;
+        ScenarioResult result = Simulation(scenario).run();
+        // Each entry is taken once its round's orders have traded
+        REQUIRE(result.pricePath.size() == 3);
+        REQUIRE(result.pricePath[0] != 0);
+    }
+
+    SECTION("Sweep")
+    {
+        std::vector<Scenario> scenarios;
+        for (int i = 0; i < 6; ++i) {
+            scenario.name = "scenario " + std::to_string(i);
+            scenario.seed = i + 1;
+            scenario.randomParameters.tradeChance = .05 * (i + 1);
+            scenarios.push_back(scenario);
+        }
+        auto parallel = runSweep(scenarios, 3);
+        REQUIRE(parallel.size() == scenarios.size());
+        for (std::size_t i = 0; i < scenarios.size(); ++i) {
+            ScenarioResult alone = Simulation(scenarios[i]).run();
+            REQUIRE(parallel[i].name == scenarios[i].name);
+            REQUIRE(parallel[i].volume == alone.volume);
+            REQUIRE(parallel[i].pricePath == alone.pricePath);
+            REQUIRE(parallel[i].pnl == alone.pnl);
+        }
+    }
+}
+
+TEST_CASE("OrderFlow")
+{
+    std::string path = (std::filesystem::temp_directory_path() /
+                        "exchange_test_flow.bin").string();
+    std::stringstream csv(
+        "round,type,participant,ref,side,quantity,price\n"
+        "1,order,900000001,1,sell,5,10\n"
+        "1,order,7,2,sell,5,11\n"
+        "2,order,4294967295,3,buy,7,11\n"
+        "not,a,record\n"
+        "2,order,7,5,buy,-1,10\n"
+        "2,order,7,6,buy,1,4294967306\n"
+        "3,cancel,7,2,,,\n"
+        "4,order,900000001,4,buy,10000,10\n");
+    OrderFlowWriter writer;
+    REQUIRE(writer.open(path));
+    std::uint64_t badLines = 0;
+    std::vector<std::uint32_t> participantIds;
+    REQUIRE(importCsv(csv, writer, &badLines, &participantIds) == 5);
+    REQUIRE(badLines == 3);
+    // Participants are renumbered in the order they appear
+    REQUIRE(participantIds == std::vector<std::uint32_t>{900000001, 7, 4294967295});
+    REQUIRE(writer.close());
+
+    SECTION("Read Back")
+    {
+        OrderFlowReader reader(2);
+        REQUIRE(reader.open(path));
+        REQUIRE(reader.getCount() == 5);
+        REQUIRE(reader.getParticipants() == 3);
+        std::vector<FlowRecord> batch;
+        std::vector<FlowRecord> records;
+        while (reader.nextBatch(batch)) {
+            REQUIRE(batch.size() <= 2);
+            records.insert(records.end(), batch.begin(), batch.end());
+        }
+        REQUIRE(records.size() == 5);
+        REQUIRE(records[2].round == 2);
+        REQUIRE(records[2].type == FlowRecord::Type::Order);
+        REQUIRE(records[2].participant == 2);
+        REQUIRE(records[2].ref == 3);
+        REQUIRE(records[2].side == Side::Buy);
+        REQUIRE(records[2].quantity == 7);
+        REQUIRE(records[2].price == 11);
+        REQUIRE(records[3].type == FlowRecord::Type::Cancel);
+        REQUIRE(records[3].ref == 2);
+
+        OrderFlowReader missing;
+        REQUIRE_FALSE(missing.open(path + ".missing"));
+    }
+
+    SECTION("Replay Into Book")
+    {
+        OrderFlowReader reader(2);
+        REQUIRE(reader.open(path));
+        Book book;
+        FlowReplayStats stats = replayIntoBook(reader, book);
+        REQUIRE(stats.orders == 4);
+        REQUIRE(stats.cancels == 1);
+        REQUIRE(stats.missedCancels == 0);
+        REQUIRE(stats.executions == 2);
+        REQUIRE(stats.volume == 7);
+        REQUIRE(book.getBestBid() == 10);
+        REQUIRE_FALSE(book.hasOffer());
+    }
+
+    SECTION("Replay Into Exchange")
+    {
+        OrderFlowReader reader(2);
+        REQUIRE(reader.open(path));
+        Exchange exchange;
+        FlowTrader flow(exchange, reader);
+        while (!flow.finished() || exchange.getRound() < 5) {
+            exchange.tick();
+        }
+        const Ledger& ledger = exchange.getLedger();
+        REQUIRE(flow.getStats().orders == 3);
+        REQUIRE(flow.getStats().cancels == 1);
+        REQUIRE(flow.getStats().missedCancels == 0);
+        // Participant 0 can't afford its last order
+        REQUIRE(flow.getSkipped() == 1);
+        REQUIRE(ledger.getShares(flow.getAccount(2)) == TRADER_STARTING_POSITION + 7);
+        REQUIRE(ledger.getMoney(flow.getAccount(2)) == TRADER_STARTING_CAPITAL - 5 * 10 - 2 * 11);
+        REQUIRE(ledger.getShares(flow.getAccount(1)) == TRADER_STARTING_POSITION - 2);
+        REQUIRE(ledger.getSharesOutstanding(flow.getAccount(1)) == 0);
+        REQUIRE_FALSE(exchange.getBook().hasBid());
+        REQUIRE_FALSE(exchange.getBook().hasOffer());
+    }
+
+    SECTION("Replay With Balances")
+    {
+        OrderFlowReader reader(2);
+        REQUIRE(reader.open(path));
+        Exchange exchange;
+        FlowTrader flow(exchange, reader, 1000000, 1000);
+        while (!flow.finished() || exchange.getRound() < 5) {
+            exchange.tick();
+        }
+        REQUIRE(flow.getSkipped() == 0);
+        REQUIRE(flow.getStats().orders == 4);
+        REQUIRE(exchange.getLedger().getMoney(flow.getAccount(0)) == 1000000 + 5 * 10);
+        REQUIRE(exchange.getBook().getBestBid() == 10);
+    }
+
+    SECTION("Malformed Records")
+    {
+        std::string badPath = path + ".bad";
+        REQUIRE(writer.open(badPath));
+        writer.write({1, 1, 0, 5, 10, FlowRecord::Type::Order, Side::Sell});
+        writer.write({1, 2, 0, 0, 10, FlowRecord::Type::Order, Side::Sell});
+        writer.write({1, 3, 0, 5, 0, FlowRecord::Type::Order, Side::Buy});
+        writer.write({1, 4, 0, 5, 10, FlowRecord::Type(7), Side::Buy});
+        writer.write({1, 5, 0, 5, 10, FlowRecord::Type::Order, Side(5)});
+        writer.write({1, 6, 2, 5, 10, FlowRecord::Type::Order, Side::Buy});
+        writer.write({2, 7, 1, 2, 10, FlowRecord::Type::Order, Side::Buy});
+        REQUIRE(writer.close());
+        auto patch32 = [&](std::size_t offset, std::uint32_t value) {
+            std::FILE* file = std::fopen(badPath.c_str(), "r+b");
+            unsigned char bytes[4];
+            flow_detail::put32(bytes, value);
+            std::fseek(file, offset, SEEK_SET);
+            std::fwrite(bytes, 1, 4, file);
+            std::fclose(file);
+        };
+        // Only participants 0 and 1 are in the header
+        patch32(16, 2);
+
+        OrderFlowReader reader(2);
+        REQUIRE(reader.open(badPath));
+        Book book;
+        FlowReplayStats stats = replayIntoBook(reader, book);
+        REQUIRE(reader.getMalformed() == 5);
+        REQUIRE(stats.orders == 2);
+        REQUIRE(stats.cancels == 0);
+        REQUIRE(stats.executions == 1);
+        REQUIRE(book.getQuantityForLevel(10) == 3);
+
+        // More participants than a replay would open accounts for
+        patch32(16, FLOW_MAX_PARTICIPANTS + 1);
+        REQUIRE_FALSE(reader.open(badPath));
+        patch32(16, 2);
+
+        // A count larger than the file is refused, even one that
+        // overflows once multiplied out
+        patch32(12, 0x20000000);
+        REQUIRE_FALSE(reader.open(badPath));
+        patch32(12, 0);
+        patch32(8, 8);
+        REQUIRE_FALSE(reader.open(badPath));
+
+        // The writer refuses participants past the limit rather than
+        // wrapping the count in the header
+        REQUIRE(writer.open(badPath));
+        writer.write({1, 1, 4294967295u, 5, 10, FlowRecord::Type::Order, Side::Sell});
+        REQUIRE(writer.getCount() == 0);
+        REQUIRE_FALSE(writer.close());
+        std::filesystem::remove(badPath);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Tape")
+{
+    Order buy(Side::Buy, 10, 10);
+    Order sell(Side::Sell, 10, 10);
+    Tape tape({1, 10});
+
+    SECTION("Bars")
+    {
+        tape.record(1, {Side::Buy, 2, 10, buy, sell});
+        tape.record(1, {Side::Sell, 4, 8, buy, sell});
+        tape.record(3, {Side::Buy, 1, 12, buy, sell});
+        tape.record(12, {Side::Buy, 3, 9, buy, sell});
+        REQUIRE(tape.getTrades() == 4);
+        REQUIRE(tape.getVolume() == 10);
+        REQUIRE(tape.getLastPrice() == 9);
+        REQUIRE(tape.getVwap() == Approx((20 + 32 + 12 + 27) / 10.0));
+
+        const auto& single = tape.getBars(1);
+        REQUIRE(single.size() == 2);
+        REQUIRE(single[0].start == 1);
+        REQUIRE(single[0].open == 10);
+        REQUIRE(single[0].high == 10);
+        REQUIRE(single[0].low == 8);
+        REQUIRE(single[0].close == 8);
+        REQUIRE(single[0].volume == 6);
+        REQUIRE(single[0].trades == 2);
+        REQUIRE(single[0].vwap() == Approx(52 / 6.0));
+        REQUIRE(single[1].start == 3);
+        REQUIRE(tape.getCurrentBar(1)->start == 12);
+
+        const auto& ten = tape.getBars(10);
+        REQUIRE(ten.size() == 1);
+        REQUIRE(ten[0].start == 0);
+        REQUIRE(ten[0].open == 10);
+        REQUIRE(ten[0].high == 12);
+        REQUIRE(ten[0].low == 8);
+        REQUIRE(ten[0].close == 12);
+        REQUIRE(ten[0].volume == 7);
+        REQUIRE(tape.getCurrentBar(10)->start == 10);
+
+        tape.close();
+        REQUIRE(tape.getCurrentBar(10) == nullptr);
+        REQUIRE(tape.getBars(10).size() == 2);
+    }
+
+    SECTION("Columns")
+    {
+        std::filesystem::path directory = std::filesystem::temp_directory_path() /
+                                          "exchange_test_tape";
+        std::filesystem::remove_all(directory);
+        REQUIRE(tape.open(directory.string()));
+        for (round_t round = 1; round <= 5000; ++round) {
+            tape.record(round, {Side::Buy, 1, price_t(round % 20 + 1), buy, sell});
+        }
+        REQUIRE(tape.close());
+
+        Column<round_t> rounds;
+        Column<price_t> prices;
+        REQUIRE(rounds.open(Tape::tapeColumn(directory.string(), "round")));
+        REQUIRE(prices.open(Tape::tapeColumn(directory.string(), "price")));
+        REQUIRE(rounds.size() == 5000);
+        REQUIRE(prices.size() == 5000);
+        REQUIRE(rounds[4999] == 5000);
+        REQUIRE(prices[4999] == 5000 % 20 + 1);
+
+        Column<unsigned long long> volume;
+        Column<price_t> high;
+        REQUIRE(volume.open(Tape::barColumn(directory.string(), 10, "volume")));
+        REQUIRE(high.open(Tape::barColumn(directory.string(), 10, "high")));
+        REQUIRE(volume.size() == tape.getBars(10).size());
+        REQUIRE(volume[0] == 9);
+        REQUIRE(volume[1] == 10);
+        REQUIRE(high[1] == 20);
+        unsigned long long total = 0;
+        for (auto value : volume) {
+            total += value;
+        }
+        REQUIRE(total == 5000);
+        std::filesystem::remove_all(directory);
+    }
+
+    SECTION("Open Mid-Bar")
+    {
+        std::filesystem::path directory = std::filesystem::temp_directory_path() /
+                                          "exchange_test_tape_mid";
+        std::filesystem::remove_all(directory);
+        tape.record(1, {Side::Buy, 2, 5, buy, sell});
+        tape.record(2, {Side::Buy, 3, 6, buy, sell});
+        REQUIRE(tape.open(directory.string()));
+        tape.record(3, {Side::Buy, 4, 7, buy, sell});
+        tape.record(4, {Side::Buy, 1, 8, buy, sell});
+        REQUIRE(tape.close());
+
+        // The bar opening found stays whole
+        REQUIRE(tape.getBars(10).size() == 1);
+        REQUIRE(tape.getBars(10)[0].open == 5);
+        REQUIRE(tape.getBars(10)[0].volume == 10);
+        Column<unsigned long long> volume;
+        Column<price_t> open;
+        Column<round_t> rounds;
+        REQUIRE(volume.open(Tape::barColumn(directory.string(), 10, "volume")));
+        REQUIRE(open.open(Tape::barColumn(directory.string(), 10, "open")));
+        REQUIRE(rounds.open(Tape::tapeColumn(directory.string(), "round")));
+        REQUIRE(volume.size() == 1);
+        REQUIRE(volume[0] == 10);
+        REQUIRE(open[0] == 5);
+        // Only trades from opening on are on the tape
+        REQUIRE(rounds.size() == 2);
+        REQUIRE(rounds[0] == 3);
+        std::filesystem::remove_all(directory);
+    }
+
+    SECTION("Exchange")
+    {
+        Exchange exchange;
+        Tape exchangeTape(exchange, {5});
+        ManualTrader t1(exchange);
+        ManualTrader t2(exchange);
+        t1.penOrder({Side::Sell, 10, 10});
+        t2.penOrder({Side::Buy, 4, 10});
+        for (int i = 0; i < 5; ++i) {
+            exchange.tick();
+        }
+        REQUIRE(exchangeTape.getTrades() == 1);
+        REQUIRE(exchangeTape.getVolume() == 4);
+        REQUIRE(exchangeTape.getCurrentBar(5)->close == 10);
+
+        // A tape that goes away stops listening
+        {
+            Tape shortTape(exchange, {5});
+            t2.penOrder({Side::Buy, 2, 10});
+            exchange.tick();
+            exchange.tick();
+            REQUIRE(shortTape.getTrades() == 1);
+        }
+        t2.penOrder({Side::Buy, 3, 10});
+        exchange.tick();
+        exchange.tick();
+        REQUIRE(exchangeTape.getTrades() == 3);
+        REQUIRE(exchangeTape.getVolume() == 9);
+    }
+}
+
+TEST_CASE("MarketData")
+{
+    SECTION("Seqlock")
+    {
+        Seqlock<Book::DepthLevel> level;
+        REQUIRE(level.version() == 0);
+        level.write({10, 5});
+        REQUIRE(level.version() == 1);
+        REQUIRE(level.read().price == 10);
+        REQUIRE(level.read().quantity == 5);
+    }
+
+    SECTION("Publishing")
+    {
+        Exchange exchange;
+        exchange.setDepthSnapshotInterval(1);
+        ManualTrader trader1(exchange);
+        ManualTrader trader2(exchange);
+        const MarketData& data = exchange.getMarketData();
+        REQUIRE_FALSE(data.getTopOfBook().hasBid());
+        REQUIRE(data.getDepth()->bids.size() == 0);
+
+        trader1.penOrder({Side::Buy, 10, 8});
+        trader1.penOrder({Side::Buy, 5, 7});
+        trader2.penOrder({Side::Sell, 4, 9});
+        for (int i = 0; i < 4; ++i) {
+            exchange.tick();
+        }
+        TopOfBook top = data.getTopOfBook();
+        REQUIRE(top.bid == 8);
+        REQUIRE(top.bidQuantity == 10);
+        REQUIRE(top.offer == 9);
+        REQUIRE(top.offerQuantity == 4);
+        REQUIRE(top.lastPrice == 0);
+
+        // Depth is only published at the start of a round
+        round_t round = exchange.getRound();
+        while (exchange.getRound() == round) {
+            exchange.tick();
+        }
+        auto depth = data.getDepth();
+        REQUIRE(depth->bids.size() == 2);
+        REQUIRE(depth->bids[0].price == 8);
+        REQUIRE(depth->bids[1].price == 7);
+        REQUIRE(depth->bids[1].quantity == 5);
+        REQUIRE(depth->offers.size() == 1);
+
+        trader2.penOrder({Side::Sell, 10, 8});
+        for (int i = 0; i < 3; ++i) {
+            exchange.tick();
+        }
+        top = data.getTopOfBook();
+        REQUIRE(top.bid == 7);
+        REQUIRE(top.lastPrice == 8);
+        // Snapshots already handed out don't change
+        REQUIRE(depth->bids.size() == 2);
+        REQUIRE(depth->bids[0].price == 8);
+        REQUIRE(data.getDepth()->bids.size() == 1);
+    }
+
+    SECTION("Concurrent Readers")
+    {
+        Exchange exchange;
+        exchange.setDepthSnapshotInterval(5);
+        DealerTrader dealer(exchange);
+        PopulationTrader population(exchange, PopulationTrader::Behaviour::RandomLimit, 200);
+        std::atomic<bool> done(false);
+        std::atomic<std::size_t> bad(0);
+        auto reader = [&]() {
+            const MarketData& data = exchange.getMarketData();
+            round_t lastRound = 0;
+            round_t lastDepthRound = 0;
+            while (!done) {
+                TopOfBook top = data.getTopOfBook();
+                if (top.round < lastRound ||
+                    top.hasBid() != (top.bid != std::numeric_limits<price_t>::min()) ||
+                    (top.hasBid() && top.hasOffer() && top.bid >= top.offer)) {
+                    ++bad;
+                }
+                lastRound = top.round;
+                auto depth = data.getDepth();
+                if (depth->round < lastDepthRound ||
+                    !std::is_sorted(depth->bids.begin(), depth->bids.end(),
+                                    [](auto a, auto b) { return a.price > b.price; }) ||
+                    !std::is_sorted(depth->offers.begin(), depth->offers.end(),
+                                    [](auto a, auto b) { return a.price < b.price; })) {
+                    ++bad;
+                }
+                lastDepthRound = depth->round;
+            }
+        };
+        std::thread first(reader);
+        std::thread second(reader);
+        while (exchange.getRound() < 300) {
+            exchange.tick();
+        }
+        done = true;
+        first.join();
+        second.join();
+        REQUIRE(bad == 0);
+        REQUIRE(exchange.getMarketData().getTopOfBookVersion() > 0);
+        // A snapshot readers held up goes out on the next tick
+        exchange.tick();
+        REQUIRE(exchange.getMarketData().getDepth()->round == 300);
+    }
+}
+
+TEST_CASE("CostAccounting")
+{
+    Exchange exchange;
+    ManualTrader trader1(exchange);
+    ManualTrader trader2(exchange);
+    DealerTrader dealer(exchange);
+
+    SECTION("Off By Default")
+    {
+        trader1.penOrder({Side::Buy, 10, 8});
+        for (int i = 0; i < 5; ++i) {
+            exchange.tick();
+        }
+        REQUIRE(exchange.getCostAccounting().getTraders().size() == 0);
+    }
+
+    SECTION("Counts and Times")
+    {
+        exchange.setCostAccounting(true);
+        Order buyOrder(Side::Buy, 10, 8);
+        trader1.penOrder(buyOrder);
+        trader2.penOrder({Side::Sell, 4, 8});
+        for (int i = 0; i < 5; ++i) {
+            exchange.tick();
+        }
+        REQUIRE(exchange.submitCancel(trader1, buyOrder.id));
+
+        auto traders = exchange.getCostAccounting().getTraders();
+        const TraderCost& first = traders.at(trader1.getId());
+        REQUIRE(first.type == "ManualTrader");
+        REQUIRE(first.tickCalls > 0);
+        REQUIRE(first.orders == 1);
+        REQUIRE(first.acceptedCalls == 1);
+        REQUIRE(first.fills == 1);
+        REQUIRE(first.tradedCalls == 1);
+        REQUIRE(first.cancels == 1);
+        REQUIRE(traders.at(trader2.getId()).fills == 1);
+        REQUIRE(traders.at(dealer.getId()).type == "DealerTrader");
+        REQUIRE(traders.at(dealer.getId()).orders == 2);
+
+        auto types = exchange.getCostAccounting().getTypes();
+        REQUIRE(types.size() == 2);
+        REQUIRE(types.at("ManualTrader").orders == 2);
+        REQUIRE(types.at("ManualTrader").fills == 2);
+        REQUIRE(types.at("ManualTrader").tickCalls ==
+                first.tickCalls + traders.at(trader2.getId()).tickCalls);
+
+        std::stringstream csv;
+        exchange.getCostAccounting().writeCsv(csv, exchange.getRound());
+        std::string line;
+        std::size_t rows = 0;
+        std::size_t typeRows = 0;
+        while (std::getline(csv, line)) {
+            ++rows;
+            typeRows += line.rfind("type,", 0) == 0;
+        }
+        REQUIRE(rows == 1 + 3 + 2);
+        REQUIRE(typeRows == 2);
+    }
+
+    SECTION("Template Trader Names")
+    {
+        exchange.setCostAccounting(true);
+        PairedTrader<int, char> paired(exchange);
+        exchange.tick();
+
+        std::stringstream csv;
+        exchange.getCostAccounting().writeCsv(csv, exchange.getRound());
+        std::string line;
+        std::getline(csv, line);
+        std::size_t columns = std::count(line.begin(), line.end(), ',');
+        bool found = false;
+        while (std::getline(csv, line)) {
+            // The name is quoted, so its comma doesn't start a column
+            if (line.find("\"PairedTrader<int, char>\"") != std::string::npos) {
+                found = true;
+                REQUIRE(std::count(line.begin(), line.end(), ',') == columns + 1);
+            }
+        }
+        REQUIRE(found);
+    }
+
+    SECTION("Coroutine Traders")
+    {
+        // Away from the dealer, which would take the sell
+        Exchange quiet;
+        quiet.setCostAccounting(true);
+        ManualTrader seller(quiet);
+        ScriptedTrader scripted(quiet);
+        quiet.tick(); // the strategy starts and submits its order
+        quiet.tick();
+        seller.penOrder({Side::Sell, 4, 5});
+        quiet.tick();
+        quiet.tick(); // the sell fills, and the strategy resumes
+        REQUIRE(scripted.log.back() == "filled");
+
+        // Resuming the strategy is counted apart from the fill
+        auto traders = quiet.getCostAccounting().getTraders();
+        const TraderCost& cost = traders.at(scripted.getId());
+        REQUIRE(cost.type == "ScriptedTrader");
+        REQUIRE(cost.fills == 1);
+        REQUIRE(cost.tradedCalls == 1);
+        REQUIRE(cost.settledCalls == 1);
+        REQUIRE(cost.totalNanos() ==
+                cost.tickNanos + cost.acceptedNanos + cost.tradedNanos + cost.settledNanos);
+        REQUIRE(traders.at(seller.getId()).settledCalls == 0);
+    }
 }
\ No newline at end of file